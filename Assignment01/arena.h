@@ -0,0 +1,79 @@
+/*
+*  arena.h: bump allocator for per-command memory
+*  shell1 keeps everything a command owns here: a copy of the line, which
+*  the lexer unquotes and splits in place (the arguments are slices of it,
+*  see lexer.h), and the argument vector pointing into it. Both come from a
+*  pointer bump and go with one arena_reset() in O(1) once the command has
+*  finished, so the reader's buffer (input.h) is free for the next line
+*  meanwhile. Only the lexer's token list lives outside, reused from line
+*  to line. Chunks are kept across resets, so a shell in steady state does
+*  no malloc or free per command at all.
+*/
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#define ARENA_CHUNK (16 * 1024)   // size of the first chunk
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    char data[];
+};
+
+struct arena {
+    struct arena_chunk *head;     // first chunk, reset goes back here
+    struct arena_chunk *current;  // chunk being filled
+    size_t used;                  // bytes used in current
+};
+
+static inline void arena_init(struct arena *a) {
+    memset(a, 0, sizeof(*a));
+}
+
+// Returns size bytes aligned for any type, valid until the next reset
+static inline void *arena_alloc(struct arena *a, size_t size) {
+    size = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+    while (a->current == NULL || a->current->size - a->used < size) {
+        if (a->current && a->current->next) {
+            // Reuse a chunk kept from before the last reset
+            a->current = a->current->next;
+            a->used = 0;
+            continue;
+        }
+        size_t chunk = a->current ? a->current->size * 2 : ARENA_CHUNK;
+        while (chunk < size) chunk *= 2;
+        struct arena_chunk *c = malloc(sizeof(*c) + chunk);
+        if (c == NULL) return NULL;
+        c->next = NULL;
+        c->size = chunk;
+        if (a->current) a->current->next = c;
+        else a->head = c;
+        a->current = c;
+        a->used = 0;
+    }
+    void *p = a->current->data + a->used;
+    a->used += size;
+    return p;
+}
+
+// Forgets every allocation, the chunks stay for the next command
+static inline void arena_reset(struct arena *a) {
+    a->current = a->head;
+    a->used = 0;
+}
+
+static inline void arena_free(struct arena *a) {
+    while (a->head) {
+        struct arena_chunk *next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+    a->current = NULL;
+    a->used = 0;
+}
+
+#endif
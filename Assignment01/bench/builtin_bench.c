@@ -0,0 +1,81 @@
+/*
+*  builtin_bench.c: builtin dispatch cost, strcmp chain against the registry
+*  Dispatches a mix of builtin and external command names the way
+*  myshellv5.c used to (is_builtin_command() and then the same strcmp chain
+*  again in execute_builtin_command()) and through builtin_find() from
+*  builtins.h, and prints nanoseconds per command for each.
+*  usage: ./builtin_bench [iterations]
+*  build: gcc -O2 -I.. builtin_bench.c -o builtin_bench
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "builtins.h"
+
+static const char *names[] = {
+    "cd", "exit", "jobs", "kill", "hash", "history", "help", "pwd", "echo",
+    "test", "printf", "time", "stats", "parallel", "timeout", "limit",
+};
+#define NNAMES (sizeof(names) / sizeof(names[0]))
+
+// Inputs: every builtin name plus common external commands
+static const char *inputs[] = {
+    "ls", "cd", "grep", "jobs", "cat", "history", "sort", "kill", "wc",
+    "help", "sed", "exit", "awk", "hash", "make", "gcc",
+};
+#define NINPUTS (sizeof(inputs) / sizeof(inputs[0]))
+
+static volatile unsigned long sink;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void handler(char **args, char *rest) {
+    sink++;
+}
+
+// Old myshellv5.c dispatch: one strcmp chain to check, a second one to run
+static int chain_is_builtin(const char *cmd) {
+    for (size_t i = 0; i < NNAMES; i++) {
+        if (strcmp(cmd, names[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static void chain_execute(const char *cmd) {
+    for (size_t i = 0; i < NNAMES; i++) {
+        if (strcmp(cmd, names[i]) == 0) {
+            sink++;
+            return;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 10000000;
+    for (size_t i = 0; i < NNAMES; i++)
+        builtin_register(names[i], handler, NULL);
+
+    double t0 = now();
+    for (long i = 0; i < iterations; i++) {
+        const char *cmd = inputs[i % NINPUTS];
+        if (chain_is_builtin(cmd)) chain_execute(cmd);
+    }
+    double t_chain = now() - t0;
+
+    t0 = now();
+    for (long i = 0; i < iterations; i++) {
+        const struct builtin *b = builtin_find(inputs[i % NINPUTS]);
+        if (b) b->fn(NULL, NULL);
+    }
+    double t_table = now() - t0;
+
+    printf("%zu builtins, %ld lookups\n", NNAMES, iterations);
+    printf("strcmp chain x2 : %6.1f ns/command\n", t_chain * 1e9 / iterations);
+    printf("sorted registry : %6.1f ns/command\n", t_table * 1e9 / iterations);
+    return 0;
+}
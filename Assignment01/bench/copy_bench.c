@@ -0,0 +1,93 @@
+/*
+*  copy_bench.c: GB/s of "cat" pipelines, forked cat against the copy stage
+*  Writes a scratch file of the given size (page cache warm) and runs each
+*  pipeline through pipeline.h twice: every stage a forked process, and with
+*  the first "cat" as a copy stage the shell runs itself (see zerocopy.h),
+*  the way myshellv2 does. Prints the best of the repeats for each.
+*     cat < in > out          file to file
+*     cat < in | cat > null   file into a pipe
+*     cat < in | wc -c        file into a pipe, a reader that looks at the data
+*  usage: ./copy_bench [MiB] [repeats]
+*  build: gcc -O2 -I.. copy_bench.c -o copy_bench
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "pipeline.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs line once, copy: the first copy stage runs in this process
+static double run(const char *line, int copy) {
+    struct pipeline pl;
+    char *text = strdup(line);
+    pipeline_init(&pl);
+    if (parse_pipeline(text, &pl) == -1) exit(1);
+    struct stage *st = copy && stage_is_copy(&pl, 0) ? &pl.stages[0] : NULL;
+    if (st) st->in_shell = 1;
+    double t0 = now();
+    start_pipeline(&pl);
+    if (st) st->status = run_copy_stage(st);
+    wait_pipeline(&pl, NULL);
+    double t = now() - t0;
+    pipeline_free(&pl);
+    free(text);
+    return t;
+}
+
+int main(int argc, char *argv[]) {
+    long mib = argc > 1 ? atol(argv[1]) : 256;
+    int repeats = argc > 2 ? atoi(argv[2]) : 5;
+    const char *tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char in[4096], out[4096], lines[3][8300];
+    snprintf(in, sizeof(in), "%s/copy_bench.in.%d", tmp, (int)getpid());
+    snprintf(out, sizeof(out), "%s/copy_bench.out.%d", tmp, (int)getpid());
+
+    int fd = open(in, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    char *block = malloc(1 << 20);
+    for (int i = 0; i < 1 << 20; i++) block[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+    for (long i = 0; fd != -1 && i < mib; i++) {
+        if (write(fd, block, 1 << 20) != 1 << 20) {
+            perror(in);
+            close(fd);
+            fd = -1;
+        }
+    }
+    free(block);
+    if (fd == -1) {
+        unlink(in);
+        return 1;
+    }
+    close(fd);
+
+    snprintf(lines[0], sizeof(lines[0]), "cat < %s > %s", in, out);
+    snprintf(lines[1], sizeof(lines[1]), "cat < %s | cat > /dev/null", in);
+    snprintf(lines[2], sizeof(lines[2]), "cat < %s | wc -c > /dev/null", in);
+    const char *names[3] = { "cat < in > out", "cat < in | cat > null", "cat < in | wc -c" };
+    printf("%ld MiB, best of %d\n", mib, repeats);
+    printf("%-24s %12s %12s\n", "pipeline", "fork+cat", "copy stage");
+    run(lines[0], 0);   // page cache warm
+    for (int l = 0; l < 3; l++) {
+        double best[2] = { 1e9, 1e9 };
+        for (int r = 0; r < repeats; r++) {
+            for (int copy = 0; copy < 2; copy++) {
+                unlink(out);    // truncating the last run's output is not part of this one
+                double t = run(lines[l], copy);
+                if (t < best[copy]) best[copy] = t;
+            }
+        }
+        printf("%-24s %8.2f GB/s %8.2f GB/s\n", names[l], mib * 1048576.0 / best[0] / 1e9,
+               mib * 1048576.0 / best[1] / 1e9);
+    }
+    unlink(in);
+    unlink(out);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+*  launch_bench.c: commands/sec of fork()+execvp() against launch_command()
+*  The benchmark first grows its own heap to imitate a shell with a large
+*  history, job table and variable store, then starts /bin/true in a loop
+*  with fork+exec, launch_command() and through the zygote (started before the
+*  heap grows) and prints the rate of each.
+*  usage: ./launch_bench [iterations] [heap MiB]
+*  build: gcc -O2 -I.. launch_bench.c -o launch_bench
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "launcher.h"
+#include "zygote.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Old launch path of every shell version: fork, execvp in the child, wait
+static void run_fork(char **argv) {
+    int status;
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    waitpid(pid, &status, 0);
+}
+
+static void run_spawn(char **argv) {
+    int status;
+    pid_t pid = launch_argv(argv);
+    if (pid > 0)
+        waitpid(pid, &status, 0);
+}
+
+static int zygote_done;
+
+static void zygote_exited(pid_t pid, int status, const struct rusage *ru) {
+    zygote_done = 1;
+}
+
+// Started by the zygote, which was forked before the heap grew
+static void run_zygote(char **argv) {
+    struct launch_spec spec;
+    int remote;
+    launch_spec_init(&spec, argv);
+    zygote_done = 0;
+    pid_t pid = zygote_launch(&spec, &remote);
+    if (pid > 0 && !remote)
+        waitpid(pid, NULL, 0);
+    while (pid > 0 && remote && !zygote_done && zygote_collect(1, NULL) >= 0);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    size_t heap_mib = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+    char *cmd[] = {"true", NULL};
+    zygote_start(zygote_exited);
+
+    // Touch every page so fork() has real page tables to copy
+    char *heap = malloc(heap_mib << 20);
+    if (heap == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    memset(heap, 1, heap_mib << 20);
+
+    double t0 = now();
+    for (int i = 0; i < iterations; i++)
+        run_fork(cmd);
+    double t_fork = now() - t0;
+
+    t0 = now();
+    for (int i = 0; i < iterations; i++)
+        run_spawn(cmd);
+    double t_spawn = now() - t0;
+
+    t0 = now();
+    for (int i = 0; i < iterations; i++)
+        run_zygote(cmd);
+    double t_zygote = now() - t0;
+
+    printf("heap %zu MiB, %d commands\n", heap_mib, iterations);
+    printf("fork+execvp   : %10.0f commands/sec\n", iterations / t_fork);
+    printf("launch_command: %10.0f commands/sec\n", iterations / t_spawn);
+    printf("zygote        : %10.0f commands/sec\n", iterations / t_zygote);
+    free(heap);
+    zygote_stop();
+    return 0;
+}
@@ -0,0 +1,322 @@
+/*
+*  shellbench.c: runs scripted workloads through every shell version
+*  Each workload is written to a script file which the shell reads as its
+*  argument (every version takes a script file, see input.h). For each shell
+*  the harness reports:
+*     startup     mean time of a run with an empty script
+*     cmds/s      script lines executed per second (median of the repeats)
+*     maxrss      peak RSS from wait4(), the shell or the largest child it reaped
+*     sys/cmd     system calls made by the shell per line, counted with
+*                 ptrace(PTRACE_SYSCALL) on the shell only (its children are
+*                 not traced), minus the calls an empty script costs
+*  Workloads only run on the versions that have the feature they exercise:
+*     trivial     N lines of "true"                              all
+*     pipeline    8-stage pipelines                              myshellv2
+*     background  "/bin/true &" lines                            v3, v4, v5
+*     history     N "history search" lines (history + index)     v4, v5
+*     vars        N variables set and exported, then expanded    version6
+*     cache       N lines of one "cache seq ..." command (memo.h) myshellv2
+*  The shells' output goes to /dev/null, HISTFILE and CACHEDIR point into a
+*  scratch dir.
+*  usage: ./shellbench [-n lines] [-r repeats] [-t timeout] [-S] shell...
+*         -S skips the syscall count (ptrace slows the run down a lot)
+*  build: gcc -O2 -I.. shellbench.c -o shellbench   (or "make bench")
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "stats.h"
+
+enum {
+    CAP_PIPES = 1,
+    CAP_BACKGROUND = 2,
+    CAP_HISTORY = 4,
+    CAP_VARS = 8,
+    CAP_CACHE = 16,
+};
+
+// What each version understands, by binary name
+static const struct { const char *name; int caps; } versions[] = {
+    { "shell1", 0 },
+    { "myshellv2", CAP_PIPES | CAP_CACHE },
+    { "myshellv3", CAP_BACKGROUND },
+    { "myshellv4", CAP_BACKGROUND | CAP_HISTORY },
+    { "myshellv5", CAP_BACKGROUND | CAP_HISTORY },
+    { "version6", CAP_VARS },
+};
+
+struct workload {
+    const char *name;
+    int caps;           // needed capability, 0 for every shell
+    long (*write)(FILE *f, long n);     // writes the script, returns its line count
+};
+
+static long write_trivial(FILE *f, long n) {
+    for (long i = 0; i < n; i++) fputs("true\n", f);
+    return n;
+}
+
+static long write_pipeline(FILE *f, long n) {
+    long lines = n / 20 + 1;
+    for (long i = 0; i < lines; i++)
+        fputs("seq 1 2000 | cat | cat | cat | cat | cat | cat | wc -l\n", f);
+    return lines;
+}
+
+static long write_background(FILE *f, long n) {
+    for (long i = 0; i < n; i++) fputs("/bin/true &\n", f);  // a path, so never a builtin
+    return n;
+}
+
+static long write_history(FILE *f, long n) {
+    for (long i = 0; i < n; i++) fprintf(f, "history search k%ld\n", i);
+    return n;
+}
+
+static long write_vars(FILE *f, long n) {
+    for (long i = 0; i < n; i++) fprintf(f, "set VAR%ld=value%ld\n", i, i);
+    for (long i = 0; i < n; i += 2) fprintf(f, "export VAR%ld\n", i);
+    for (long i = 0; i < n; i++) fprintf(f, "eco $VAR%ld $VAR%ld $VAR%ld\n", i, n - 1 - i, i / 2);
+    return n + (n + 1) / 2 + n;
+}
+
+static long write_cache(FILE *f, long n) {
+    for (long i = 0; i < n; i++) fputs("cache seq 1 1000\n", f);
+    return n;
+}
+
+static const struct workload workloads[] = {
+    { "trivial", 0, write_trivial },
+    { "pipeline", CAP_PIPES, write_pipeline },
+    { "background", CAP_BACKGROUND, write_background },
+    { "history", CAP_HISTORY, write_history },
+    { "vars", CAP_VARS, write_vars },
+    { "cache", CAP_CACHE, write_cache },
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static char scratch[] = "/tmp/shellbench.XXXXXX";
+static double timeout_s = 120;
+
+struct run {
+    int ok;             // exited normally within the timeout
+    double seconds;
+    long maxrss;        // KiB
+    long syscalls;      // -1 when not counted
+};
+
+static void on_alarm(int sig) {
+    (void)sig;  // only there to interrupt wait4()
+}
+
+// Child side: script on argv, output to /dev/null, optionally traced
+static void exec_shell(const char *shell, const char *script, int trace) {
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, 0);
+    dup2(null, 1);
+    dup2(null, 2);
+    if (trace) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);     // lets the parent set its options before exec
+    }
+    execl(shell, shell, script, (char *)NULL);
+    _exit(127);
+}
+
+// Counts syscall stops until the tracee exits; each call stops twice
+static int trace_syscalls(pid_t pid, int *status, struct rusage *ru, long *calls) {
+    long stops = 0;
+    if (waitpid(pid, status, 0) != pid || !WIFSTOPPED(*status)) return -1;
+    ptrace(PTRACE_SETOPTIONS, pid, NULL,
+           (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL));
+    int sig = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)sig) == -1) return -1;
+        if (wait4(pid, status, 0, ru) != pid) return -1;
+        if (WIFEXITED(*status) || WIFSIGNALED(*status)) break;
+        sig = 0;
+        if (WSTOPSIG(*status) == (SIGTRAP | 0x80)) stops++;
+        else if (*status >> 16 == 0) sig = WSTOPSIG(*status);  // pass real signals on
+    }
+    *calls = stops / 2;
+    return 0;
+}
+
+static struct run run_shell(const char *shell, const char *script, int trace) {
+    struct run r = { 0, 0, 0, -1 };
+    struct rusage ru;
+    int status;
+    uint64_t start = stats_now_ns();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return r;
+    }
+    if (pid == 0) exec_shell(shell, script, trace);
+
+    if (trace) {
+        if (trace_syscalls(pid, &status, &ru, &r.syscalls) == -1) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            r.syscalls = -1;
+            return r;
+        }
+    } else {
+        alarm((unsigned)timeout_s);
+        pid_t got = wait4(pid, &status, 0, &ru);
+        alarm(0);
+        if (got != pid) {
+            fprintf(stderr, "%s: timed out on %s\n", shell, script);
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            return r;
+        }
+    }
+    r.seconds = (stats_now_ns() - start) / 1e9;
+    r.maxrss = ru.ru_maxrss;
+    r.ok = WIFEXITED(status) && WEXITSTATUS(status) != 127;
+    return r;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int shell_caps(const char *shell) {
+    char *copy = strdup(shell);
+    const char *base = basename(copy);
+    int caps = -1;
+    for (size_t i = 0; i < COUNT(versions); i++)
+        if (strcmp(base, versions[i].name) == 0) caps = versions[i].caps;
+    free(copy);
+    return caps < 0 ? 0 : caps;
+}
+
+static void bench_shell(const char *shell, long n, int repeats, int count_syscalls) {
+    char script[64];
+    int caps = shell_caps(shell);
+
+    // Startup: an empty script, many times
+    snprintf(script, sizeof(script), "%s/empty", scratch);
+    fclose(fopen(script, "w"));
+    double total = 0;
+    long rss = 0;
+    int runs = repeats * 10;
+    for (int i = 0; i < runs; i++) {
+        struct run r = run_shell(shell, script, 0);
+        if (!r.ok) {
+            printf("%-12s does not run\n", shell);
+            return;
+        }
+        total += r.seconds;
+        if (r.maxrss > rss) rss = r.maxrss;
+    }
+    long base_calls = count_syscalls ? run_shell(shell, script, 1).syscalls : -1;
+    printf("%-12s %-10s %8s %8.1fus %10s %8ldKiB", shell, "startup", "-", total / runs * 1e6, "-", rss);
+    if (base_calls >= 0) printf(" %8ld total\n", base_calls);
+    else printf(" %8s\n", "-");
+
+    for (size_t w = 0; w < COUNT(workloads); w++) {
+        if ((workloads[w].caps & caps) != workloads[w].caps) continue;
+        snprintf(script, sizeof(script), "%s/%s", scratch, workloads[w].name);
+        FILE *f = fopen(script, "w");
+        long lines = workloads[w].write(f, n);
+        fclose(f);
+
+        double times[repeats];
+        long peak = 0;
+        int ok = 1;
+        for (int i = 0; i < repeats && ok; i++) {
+            // Fresh history file per run so every run does the same work
+            char hist[64];
+            snprintf(hist, sizeof(hist), "%s/histfile", scratch);
+            unlink(hist);
+            struct run r = run_shell(shell, script, 0);
+            ok = r.ok;
+            times[i] = r.seconds;
+            if (r.maxrss > peak) peak = r.maxrss;
+        }
+        if (!ok) {
+            printf("%-12s %-10s failed\n", shell, workloads[w].name);
+            continue;
+        }
+        qsort(times, repeats, sizeof(double), cmp_double);
+        double median = times[repeats / 2];
+        printf("%-12s %-10s %8ld %9.3fs %10.0f %8ldKiB", shell, workloads[w].name, lines,
+               median, lines / median, peak);
+        if (count_syscalls && base_calls >= 0) {
+            char hist[64];
+            snprintf(hist, sizeof(hist), "%s/histfile", scratch);
+            unlink(hist);
+            struct run r = run_shell(shell, script, 1);
+            if (r.syscalls >= 0) printf(" %8.1f\n", (double)(r.syscalls - base_calls) / lines);
+            else printf(" %8s\n", "-");
+        } else {
+            printf(" %8s\n", "-");
+        }
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long n = 2000;
+    int repeats = 3, count_syscalls = 1, opt;
+    while ((opt = getopt(argc, argv, "n:r:t:S")) != -1) {
+        switch (opt) {
+        case 'n': n = atol(optarg); break;
+        case 'r': repeats = atoi(optarg); break;
+        case 't': timeout_s = atof(optarg); break;
+        case 'S': count_syscalls = 0; break;
+        default:
+            fprintf(stderr, "usage: %s [-n lines] [-r repeats] [-t timeout] [-S] shell...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind == argc || n <= 0 || repeats <= 0) {
+        fprintf(stderr, "usage: %s [-n lines] [-r repeats] [-t timeout] [-S] shell...\n", argv[0]);
+        return 1;
+    }
+    if (mkdtemp(scratch) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char hist[64];
+    snprintf(hist, sizeof(hist), "%s/histfile", scratch);
+    setenv("HISTFILE", hist, 1);
+    char cache[64];
+    snprintf(cache, sizeof(cache), "%s/cachedir", scratch);
+    setenv("CACHEDIR", cache, 1);
+
+    struct sigaction sa = { .sa_handler = on_alarm };
+    sigaction(SIGALRM, &sa, NULL);  // no SA_RESTART, the alarm must end wait4()
+
+    printf("%-12s %-10s %8s %10s %10s %11s %8s\n", "shell", "workload", "lines", "time", "cmds/s", "maxrss", "sys/cmd");
+    for (int i = optind; i < argc; i++) bench_shell(argv[i], n, repeats, count_syscalls);
+
+    // Leave nothing behind in /tmp
+    DIR *d = opendir(cache);
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) unlinkat(dirfd(d), e->d_name, 0);
+    if (d) closedir(d);
+    rmdir(cache);
+    const char *files[] = { "empty", "histfile", "history", "trivial", "pipeline", "background", "vars", "cache" };
+    char path[64];
+    for (size_t i = 0; i < COUNT(files); i++) {
+        snprintf(path, sizeof(path), "%s/%s", scratch, files[i]);
+        unlink(path);
+    }
+    rmdir(scratch);
+    return 0;
+}
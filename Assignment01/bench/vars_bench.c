@@ -0,0 +1,98 @@
+/*
+*  vars_bench.c: cost of set/get/export in the variable store
+*  Inserts N variables, reads each one back and exports each one, for N from
+*  10^3 to 10^6, and prints nanoseconds per operation. The old linear
+*  vars[] scan of version6.c is timed next to it up to 10^4 variables,
+*  past that it is quadratic and takes minutes.
+*  usage: ./vars_bench
+*  build: gcc -O2 -I.. vars_bench.c -o vars_bench
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "vars.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The store version6.c used before vars.h, without its 100 entry cap
+struct linear_var { char *name, *value; int global; };
+static struct linear_var *linear;
+static int linear_count;
+
+static void linear_set(const char *name, const char *value, int global) {
+    for (int i = 0; i < linear_count; i++) {
+        if (strcmp(linear[i].name, name) == 0) {
+            free(linear[i].value);
+            linear[i].value = strdup(value);
+            linear[i].global = global;
+            return;
+        }
+    }
+    linear[linear_count].name = strdup(name);
+    linear[linear_count].value = strdup(value);
+    linear[linear_count++].global = global;
+}
+
+static char *linear_get(const char *name) {
+    for (int i = 0; i < linear_count; i++) {
+        if (strcmp(linear[i].name, name) == 0)
+            return linear[i].value;
+    }
+    return NULL;
+}
+
+int main(void) {
+    char name[32];
+    printf("%9s %8s %10s %10s %10s\n", "vars", "store", "set ns", "get ns", "export ns");
+    for (long n = 1000; n <= 1000000; n *= 10) {
+        struct var_table t = {0};
+        double t0 = now();
+        for (long i = 0; i < n; i++) {
+            snprintf(name, sizeof(name), "VAR_%ld", i);
+            var_set(&t, name, "value", 0);
+        }
+        double t_set = now() - t0;
+        t0 = now();
+        for (long i = 0; i < n; i++) {
+            snprintf(name, sizeof(name), "VAR_%ld", i);
+            if (var_find(&t, name) == NULL) abort();
+        }
+        double t_get = now() - t0;
+        t0 = now();
+        for (long i = 0; i < n; i++) {
+            snprintf(name, sizeof(name), "VAR_%ld", i);
+            var_find(&t, name)->global = 1;
+        }
+        double t_export = now() - t0;
+        printf("%9ld %8s %10.1f %10.1f %10.1f\n", n, "hash", t_set * 1e9 / n, t_get * 1e9 / n, t_export * 1e9 / n);
+        var_table_free(&t);
+
+        if (n > 10000) continue;
+        linear = calloc(n, sizeof(*linear));
+        linear_count = 0;
+        t0 = now();
+        for (long i = 0; i < n; i++) {
+            snprintf(name, sizeof(name), "VAR_%ld", i);
+            linear_set(name, "value", 0);
+        }
+        t_set = now() - t0;
+        t0 = now();
+        for (long i = 0; i < n; i++) {
+            snprintf(name, sizeof(name), "VAR_%ld", i);
+            if (linear_get(name) == NULL) abort();
+        }
+        t_get = now() - t0;
+        printf("%9ld %8s %10.1f %10.1f %10s\n", n, "linear", t_set * 1e9 / n, t_get * 1e9 / n, "-");
+        for (int i = 0; i < linear_count; i++) {
+            free(linear[i].name);
+            free(linear[i].value);
+        }
+        free(linear);
+    }
+    return 0;
+}
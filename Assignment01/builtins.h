@@ -0,0 +1,75 @@
+/*
+*  builtins.h: builtin command registry
+*  Builtins are kept in one table sorted by name, so finding the handler for
+*  a command is a single binary search (a handful of strcmp calls) instead of
+*  a chain of strcmp/strncmp tests run once to check and again to dispatch.
+*  Lookups match whole names only, "listfoo" is not "list".
+*  builtin_register() adds a builtin at run time and keeps the table sorted.
+*  A handler gets the split arguments and the raw text after the command
+*  name (for builtins such as eco that want their input untouched).
+*/
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void (*builtin_fn)(char **args, char *rest);
+
+struct builtin {
+    const char *name;
+    builtin_fn fn;
+    const char *help;   // usage line for "help", NULL to leave it out
+};
+
+static struct builtin *builtin_table;
+static size_t builtin_count, builtin_cap;
+
+// Adds or replaces a builtin
+static inline void builtin_register(const char *name, builtin_fn fn, const char *help) {
+    size_t lo = 0, hi = builtin_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (strcmp(builtin_table[mid].name, name) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < builtin_count && strcmp(builtin_table[lo].name, name) == 0) {
+        builtin_table[lo].fn = fn;
+        builtin_table[lo].help = help;
+        return;
+    }
+    if (builtin_count == builtin_cap) {
+        builtin_cap = builtin_cap ? builtin_cap * 2 : 16;
+        builtin_table = realloc(builtin_table, builtin_cap * sizeof(*builtin_table));
+    }
+    memmove(&builtin_table[lo + 1], &builtin_table[lo], (builtin_count - lo) * sizeof(*builtin_table));
+    builtin_table[lo].name = name;
+    builtin_table[lo].fn = fn;
+    builtin_table[lo].help = help;
+    builtin_count++;
+}
+
+// Returns the builtin called name, or NULL for an external command
+static inline const struct builtin *builtin_find(const char *name) {
+    size_t lo = 0, hi = builtin_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int c = strcmp(builtin_table[mid].name, name);
+        if (c == 0) return &builtin_table[mid];
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+// Prints the usage line of every builtin, in name order
+static inline void builtin_print_help(void) {
+    printf("Built-in commands:\n");
+    for (size_t i = 0; i < builtin_count; i++) {
+        if (builtin_table[i].help)
+            printf("%s\n", builtin_table[i].help);
+    }
+}
+
+#endif
@@ -0,0 +1,307 @@
+/*
+*  cgroup.h: cgroup v2 resource limits for the commands a line starts
+*  "limit [options] command..." runs every stage of the line in one new
+*  cgroup v2 group, so a job cannot starve the foreground or other jobs:
+*     -c PCT      cpu.max, PCT percent of one CPU (250 is two and a half)
+*     -m SIZE     memory.max, SIZE in bytes or with a K, M or G suffix
+*     -i DEV=RATE io.max, RATE bytes/s (suffixes too) read and written on
+*                 the block device DEV, e.g. -i /dev/sda=10M
+*  Groups are made under the shell's own cgroup on the cgroup2 mount, one per
+*  line, named pucit-<shell pid>-<n>. The controllers are enabled in the
+*  parent's cgroup.subtree_control; when the shell itself sits in that group
+*  (the kernel refuses controllers there) it first moves itself, and the
+*  zygote if there is one, into a pucit-<pid>-shell leaf. The child joins
+*  its group between fork and exec by writing to cgroup.procs (the pre_exec
+*  hook of launcher.h), so it never runs a moment unlimited.
+*  Without cgroup v2, delegation or one of the controllers, the limits fall
+*  back to setrlimit(): memory becomes RLIMIT_AS, cpu and io have no rlimit
+*  and are only reported as not applied.
+*  limits_describe() reads a group's usage and pressure (PSI) for jobs and
+*  limits_remove() deletes the group once the job is over.
+*/
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#define LIMITS_PATH_MAX 4096
+
+struct limits {
+    long cpu_pct;           // 0: no cpu limit
+    long long mem;          // bytes, 0: no memory limit
+    char io[128];           // io.max line, "" for none
+    char cgroup[LIMITS_PATH_MAX];   // the group made for the line, "" in the fallback
+    int procs_fd;           // its cgroup.procs, written by the child, -1 if none
+};
+
+static struct {
+    char base[LIMITS_PATH_MAX];     // the shell's cgroup, "" when there is none to use
+    int ready;
+    int moved;              // the shell lives in its leaf group now
+    unsigned next;          // for group names
+} limits_state;
+
+// Parses "10M" style sizes, -1 if it is not one
+static inline long long limits_size(const char *s) {
+    char *end;
+    long long n = strtoll(s, &end, 10);
+    if (end == s || n < 0) return -1;
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; end++; break;
+    case 'm': case 'M': n <<= 20; end++; break;
+    case 'g': case 'G': n <<= 30; end++; break;
+    }
+    return *end ? -1 : n;
+}
+
+static inline int limits_write(const char *dir, const char *file, const char *text) {
+    char path[2 * LIMITS_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = write(fd, text, strlen(text));
+    int err = errno;
+    close(fd);
+    errno = err;
+    return n == (ssize_t)strlen(text) ? 0 : -1;
+}
+
+static inline int limits_read(const char *dir, const char *file, char *buf, size_t size) {
+    char path[2 * LIMITS_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    return 0;
+}
+
+// Finds the cgroup2 mount and the shell's group below it, once
+static inline const char *limits_base(void) {
+    if (limits_state.ready) return limits_state.base[0] ? limits_state.base : NULL;
+    limits_state.ready = 1;
+    char line[LIMITS_PATH_MAX], mount[LIMITS_PATH_MAX] = "", group[LIMITS_PATH_MAX] = "";
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        // "id parent major:minor root mountpoint options - type source ..."
+        char *dash = strstr(line, " - cgroup2 ");
+        char point[LIMITS_PATH_MAX];
+        if (dash && sscanf(line, "%*s %*s %*s %*s %4095s", point) == 1) {
+            strcpy(mount, point);
+            break;
+        }
+    }
+    if (f) fclose(f);
+    f = fopen("/proc/self/cgroup", "r");
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            strcpy(group, line + 3);
+        }
+    }
+    if (f) fclose(f);
+    if (mount[0] == '\0' || group[0] == '\0') return NULL;
+    snprintf(limits_state.base, sizeof(limits_state.base), "%s%s", mount,
+             strcmp(group, "/") == 0 ? "" : group);
+    if (access(limits_state.base, W_OK) == -1) limits_state.base[0] = '\0';
+    return limits_state.base[0] ? limits_state.base : NULL;
+}
+
+// Moves the shell (and the zygote, other_pid > 0) into a leaf of base so
+// that base may hand controllers down
+static inline int limits_move_shell(const char *base, pid_t other_pid) {
+    char leaf[LIMITS_PATH_MAX + 64], pid[32];
+    snprintf(leaf, sizeof(leaf), "%s/pucit-%d-shell", base, (int)getpid());
+    if (mkdir(leaf, 0755) == -1 && errno != EEXIST) return -1;
+    if (limits_write(leaf, "cgroup.procs", "0") == -1) return -1;
+    if (other_pid > 0) {
+        snprintf(pid, sizeof(pid), "%d", (int)other_pid);
+        limits_write(leaf, "cgroup.procs", pid);
+    }
+    limits_state.moved = 1;
+    return 0;
+}
+
+// Whether the blank separated list has word in it
+static inline int limits_has_word(const char *list, const char *word) {
+    size_t len = strlen(word);
+    for (const char *p = list; (p = strstr(p, word)) != NULL; p += len) {
+        if ((p == list || p[-1] == ' ') && (p[len] == '\0' || p[len] == ' ' || p[len] == '\n'))
+            return 1;
+    }
+    return 0;
+}
+
+// Turns on the controllers lim needs for the groups below base
+static inline int limits_enable(const char *base, const struct limits *lim, pid_t other_pid) {
+    char have[256], want[64] = "";
+    if (limits_read(base, "cgroup.controllers", have, sizeof(have)) == -1) return -1;
+    const char *names[3] = { lim->cpu_pct ? "cpu" : NULL, lim->mem ? "memory" : NULL, lim->io[0] ? "io" : NULL };
+    for (int i = 0; i < 3; i++) {
+        if (names[i] == NULL) continue;
+        if (!limits_has_word(have, names[i])) {
+            errno = ENOTSUP;
+            return -1;
+        }
+        snprintf(want + strlen(want), sizeof(want) - strlen(want), "%s+%s", want[0] ? " " : "", names[i]);
+    }
+    if (limits_write(base, "cgroup.subtree_control", want) == 0) return 0;
+    if (errno != EBUSY || limits_state.moved || limits_move_shell(base, other_pid) == -1) return -1;
+    return limits_write(base, "cgroup.subtree_control", want);
+}
+
+// Reads the options in front of the command. Returns the number of words
+// they took, or -1 with the error printed
+static inline int limits_parse(char **args, struct limits *lim) {
+    memset(lim, 0, sizeof(*lim));
+    lim->procs_fd = -1;
+    int a = 0;
+    while (args[a] && args[a][0] == '-' && args[a][1] && args[a][2] == '\0') {
+        const char *value = args[a + 1];
+        if (value == NULL) {
+            fprintf(stderr, "limit: %s needs a value\n", args[a]);
+            return -1;
+        }
+        if (args[a][1] == 'c') {
+            char *end;
+            lim->cpu_pct = strtol(value, &end, 10);
+            if (*end || lim->cpu_pct <= 0) {
+                fprintf(stderr, "limit: bad cpu percentage '%s'\n", value);
+                return -1;
+            }
+        } else if (args[a][1] == 'm') {
+            lim->mem = limits_size(value);
+            if (lim->mem <= 0) {
+                fprintf(stderr, "limit: bad memory size '%s'\n", value);
+                return -1;
+            }
+        } else if (args[a][1] == 'i') {
+            char dev[256];
+            const char *eq = strchr(value, '=');
+            long long rate = eq ? limits_size(eq + 1) : -1;
+            struct stat sb;
+            snprintf(dev, sizeof(dev), "%.*s", eq ? (int)(eq - value) : 0, value);
+            if (rate <= 0 || stat(dev, &sb) == -1 || !S_ISBLK(sb.st_mode)) {
+                fprintf(stderr, "limit: -i wants DEVICE=RATE with a block device, got '%s'\n", value);
+                return -1;
+            }
+            snprintf(lim->io, sizeof(lim->io), "%u:%u rbps=%lld wbps=%lld",
+                     major(sb.st_rdev), minor(sb.st_rdev), rate, rate);
+        } else {
+            fprintf(stderr, "limit: unknown option %s\n", args[a]);
+            return -1;
+        }
+        a += 2;
+    }
+    if (args[a] == NULL || a == 0) {
+        fprintf(stderr, "usage: limit [-c cpu%%] [-m size] [-i dev=rate] command...\n");
+        return -1;
+    }
+    return a;
+}
+
+// Makes the group of one line and sets its limits. On failure lim is left
+// for the setrlimit() fallback and the reason is printed. other_pid is a
+// process to move along with the shell if it has to leave its group
+static inline void limits_create(struct limits *lim, pid_t other_pid) {
+    const char *base = limits_base();
+    const char *why = "no writable cgroup v2 group";
+    if (base && limits_enable(base, lim, other_pid) == 0) {
+        snprintf(lim->cgroup, sizeof(lim->cgroup), "%s/pucit-%d-%u", base, (int)getpid(), limits_state.next++);
+        char value[64];
+        int ok = mkdir(lim->cgroup, 0755) == 0;
+        if (ok && lim->cpu_pct) {
+            snprintf(value, sizeof(value), "%ld 100000", lim->cpu_pct * 1000);
+            ok = limits_write(lim->cgroup, "cpu.max", value) == 0;
+        }
+        if (ok && lim->mem) {
+            snprintf(value, sizeof(value), "%lld", lim->mem);
+            ok = limits_write(lim->cgroup, "memory.max", value) == 0;
+        }
+        if (ok && lim->io[0]) ok = limits_write(lim->cgroup, "io.max", lim->io) == 0;
+        if (ok) {
+            char procs[LIMITS_PATH_MAX + 64];
+            snprintf(procs, sizeof(procs), "%s/cgroup.procs", lim->cgroup);
+            lim->procs_fd = open(procs, O_WRONLY | O_CLOEXEC);
+            if (lim->procs_fd != -1) return;
+        }
+        why = strerror(errno);
+        rmdir(lim->cgroup);
+        lim->cgroup[0] = '\0';
+    } else if (base) {
+        why = errno == ENOTSUP ? "controller not delegated" : strerror(errno);
+    }
+    fprintf(stderr, "limit: cgroup v2 unavailable (%s), using setrlimit%s\n", why,
+            lim->cpu_pct || lim->io[0] ? ", cpu and io limits not applied" : "");
+}
+
+// The pre_exec hook: joins the group, or sets the rlimit fallback
+static inline int limits_apply(const void *arg) {
+    const struct limits *lim = arg;
+    if (lim->procs_fd != -1)
+        return write(lim->procs_fd, "0", 1) == 1 ? 0 : errno;
+    if (lim->mem) {
+        struct rlimit rl = { lim->mem, lim->mem };
+        if (setrlimit(RLIMIT_AS, &rl) == -1) return errno;
+    }
+    return 0;
+}
+
+// The parent is done starting the line's commands
+static inline void limits_started(struct limits *lim) {
+    if (lim->procs_fd != -1) close(lim->procs_fd);
+    lim->procs_fd = -1;
+}
+
+// Deletes a group once nothing runs in it, 0 on success
+static inline int limits_remove(const char *cgroup) {
+    return rmdir(cgroup);
+}
+
+// Removes every group this shell made that is empty now, at exit
+static inline void limits_cleanup(void) {
+    if (limits_state.base[0] == '\0') return;
+    char prefix[32];
+    int len = snprintf(prefix, sizeof(prefix), "pucit-%d-", (int)getpid());
+    DIR *d = opendir(limits_state.base);
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, prefix, len) == 0 && strcmp(e->d_name + len, "shell") != 0)
+            unlinkat(dirfd(d), e->d_name, AT_REMOVEDIR);
+    }
+    if (d) closedir(d);
+}
+
+// Appends " name N%" with the "some avg10" of a pressure file, if it has one
+static inline void limits_pressure(const char *cgroup, const char *name, char *buf, size_t size) {
+    char text[256];
+    double avg;
+    size_t len = strlen(buf);
+    if (limits_read(cgroup, name, text, sizeof(text)) == 0 && sscanf(text, "some avg10=%lf", &avg) == 1)
+        snprintf(buf + len, size - len, " %.*s %.1f%%", (int)strcspn(name, "."), name, avg);
+}
+
+// "cpu 0.125s mem 3.2MiB psi cpu 1.2% memory 0.0% io 0.0%" for a group
+static inline void limits_describe(const char *cgroup, char *buf, size_t size) {
+    char stat[1024];
+    unsigned long long usec = 0, mem = 0;
+    if (limits_read(cgroup, "cpu.stat", stat, sizeof(stat)) == 0) sscanf(stat, "usage_usec %llu", &usec);
+    if (limits_read(cgroup, "memory.current", stat, sizeof(stat)) == 0) mem = strtoull(stat, NULL, 10);
+    snprintf(buf, size, "cpu %.3fs mem %.1fMiB psi", usec / 1e6, mem / 1048576.0);
+    limits_pressure(cgroup, "cpu.pressure", buf, size);
+    limits_pressure(cgroup, "memory.pressure", buf, size);
+    limits_pressure(cgroup, "io.pressure", buf, size);
+}
+
+#endif
@@ -0,0 +1,301 @@
+/*
+*  evloop.h: epoll based event loop of the interactive shell
+*  Everything the shell waits for goes through one epoll set:
+*     - the input descriptor (terminal or pipe), armed only while the shell
+*       is idle at the prompt
+*     - a signalfd for SIGCHLD and SIGINT, both blocked for normal delivery,
+*       so no handler runs asynchronously and no system call gets EINTR
+*     - one pidfd per child (background jobs and the foreground command),
+*       readable once that child has exited
+*     - the zygote socket when commands are started by the zygote (zygote.h),
+*       whose exit reports finish those jobs
+*     - the timerfd of the command deadlines (timeouts.h)
+*  A finished child is reaped by pid as soon as its pidfd fires. If pidfds are
+*  not available (kernel before 5.3) SIGCHLD falls back to jobs_reap().
+*  An exit that nobody is waiting for yet (a pipeline stage that ends while
+*  an earlier one is waited for, reaped by jobs_reap() or reported by the
+*  zygote) is kept until wait_foreground() or watch_job() claims its pid.
+*  Input that epoll cannot watch (a regular file given as a script) is simply
+*  read without waiting, pending events are still handled in between.
+*/
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "jobs.h"
+#include "zygote.h"
+
+#define EV_MAX_EVENTS 64
+
+// Tags in the upper half of epoll_data.u64, the lower half holds the pid
+#define EV_TAG_INPUT  1ULL
+#define EV_TAG_SIGNAL 2ULL
+#define EV_TAG_PIDFD  3ULL
+#define EV_TAG_ZYGOTE 4ULL
+#define EV_TAG_TIMER  5ULL
+
+// What event_loop_wait() woke up for
+enum { EV_INPUT = 1, EV_JOBS, EV_INTERRUPT };
+
+struct ev_exit {
+    pid_t pid;
+    int status;
+    struct rusage usage;
+};
+
+struct event_loop {
+    int epoll_fd;
+    int signal_fd;
+    int input_fd;           // -1 when commands come from a -c string
+    int input_pollable;     // epoll accepted input_fd
+    int input_armed;        // input_fd is enabled in the set (EPOLLONESHOT)
+    int unwatched;          // children without a pidfd, reaped on SIGCHLD
+    pid_t fg_pid;           // foreground child being waited for, 0 if none
+    uint64_t fg_started;    // when its spawn returned, for the wait latency
+    int fg_status;
+    struct rusage fg_usage;
+    int fg_done;
+    int remote_done;        // the zygote reported a finished job
+    struct ev_exit *early;  // exits nobody was waiting for yet
+    int early_count, early_cap;
+};
+
+static struct event_loop evl = { .epoll_fd = -1, .signal_fd = -1, .input_fd = -1 };
+
+static inline int ev_pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static inline int ev_add(int fd, uint32_t events, uint64_t tag, pid_t pid) {
+    struct epoll_event ev = { .events = events };
+    ev.data.u64 = tag << 32 | (uint32_t)pid;
+    return epoll_ctl(evl.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Blocks SIGCHLD/SIGINT, creates the signalfd and the epoll set. A zygote
+// should be started before, so it holds none of these descriptors
+static inline int event_loop_init(int input_fd) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, NULL);  // the launcher unblocks them in children
+
+    evl.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    evl.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (evl.signal_fd == -1 || evl.epoll_fd == -1) {
+        perror("event loop");
+        return -1;
+    }
+    ev_add(evl.signal_fd, EPOLLIN, EV_TAG_SIGNAL, 0);
+    if (zyg.pid != -1)
+        ev_add(zyg.fd, EPOLLIN, EV_TAG_ZYGOTE, 0);  // started first, see zygote_start()
+    if (timeouts_init() != -1)
+        ev_add(timeouts.fd, EPOLLIN, EV_TAG_TIMER, 0);
+    evl.input_fd = input_fd;
+    if (input_fd >= 0) {
+        evl.input_pollable = ev_add(input_fd, EPOLLIN | EPOLLONESHOT, EV_TAG_INPUT, 0) == 0;
+        evl.input_armed = evl.input_pollable;
+    }
+    return 0;
+}
+
+// Removes and returns the early exit report of pid, 0 if there is none
+static inline int ev_take_early(pid_t pid, struct ev_exit *out) {
+    for (int i = 0; i < evl.early_count; i++) {
+        if (evl.early[i].pid != pid) continue;
+        *out = evl.early[i];
+        evl.early[i] = evl.early[--evl.early_count];
+        return 1;
+    }
+    return 0;
+}
+
+static inline void ev_keep_early(pid_t pid, int status, const struct rusage *ru) {
+    if (evl.early_count == evl.early_cap) {
+        evl.early_cap = evl.early_cap ? evl.early_cap * 2 : 8;
+        evl.early = realloc(evl.early, evl.early_cap * sizeof(*evl.early));
+    }
+    evl.early[evl.early_count++] = (struct ev_exit){ pid, status, *ru };
+}
+
+// Starts watching a background job through its pidfd, a job the zygote
+// started is reported by the zygote instead
+static inline void watch_job(struct job *j) {
+    struct ev_exit e;
+    if (ev_take_early(j->pid, &e)) {
+        job_finish(j, e.status, &e.usage);
+        return;
+    }
+    if (j->remote) return;
+    j->pidfd = ev_pidfd_open(j->pid);
+    if (j->pidfd == -1 || ev_add(j->pidfd, EPOLLIN, EV_TAG_PIDFD, j->pid) == -1) {
+        if (j->pidfd != -1) close(j->pidfd);
+        j->pidfd = -1;
+        evl.unwatched++;
+    }
+}
+
+// Called by jobs_reap() for a child that is not a background job: the
+// foreground command, or one that is kept until it is claimed
+static inline void ev_other_child(pid_t pid, int status, const struct rusage *ru) {
+    if (pid == evl.fg_pid) {
+        evl.fg_status = status;
+        evl.fg_usage = *ru;
+        evl.fg_done = 1;
+        stats_child(ru, stats_now_ns() - evl.fg_started);
+    } else {
+        ev_keep_early(pid, status, ru);
+    }
+}
+
+// Reaps every child that has exited, for those without a pidfd. Returns 1
+// if a background job finished
+static inline int ev_reap(void) {
+    struct job *before = jobs.done_tail;
+    int finished = 0;
+    jobs_reap(ev_other_child);
+    for (struct job *j = before ? before->next : jobs.done_head; j; j = j->next) {
+        if (j->pidfd == -1) evl.unwatched--;
+        finished = 1;
+    }
+    return finished;
+}
+
+// Exit report from the zygote, for the foreground command or a job
+static inline void ev_zygote_child(pid_t pid, int status, const struct rusage *ru) {
+    if (pid == evl.fg_pid) {
+        ev_other_child(pid, status, ru);
+        return;
+    }
+    struct job *j = job_by_pid(pid);
+    if (j) {
+        job_finish(j, status, ru);
+        evl.remote_done = 1;
+        return;
+    }
+    ev_keep_early(pid, status, ru);  // wait_foreground() or watch_job() picks it up
+}
+
+// Handles one ready descriptor, returns the EV_ code it stands for or 0
+static inline int ev_dispatch(const struct epoll_event *e) {
+    uint64_t tag = e->data.u64 >> 32;
+    pid_t pid = (pid_t)(uint32_t)e->data.u64;
+    int result = 0, status;
+    struct rusage ru;
+
+    if (tag == EV_TAG_INPUT) {
+        evl.input_armed = 0;
+        return EV_INPUT;
+    }
+    if (tag == EV_TAG_SIGNAL) {
+        struct signalfd_siginfo si;
+        int chld = 0;
+        while (read(evl.signal_fd, &si, sizeof(si)) == sizeof(si)) {
+            if (si.ssi_signo == SIGINT) result = EV_INTERRUPT;
+            else chld = 1;
+        }
+        if (chld && evl.unwatched > 0 && ev_reap() && !result) result = EV_JOBS;
+        return result;
+    }
+    if (tag == EV_TAG_TIMER) {
+        timeouts_fire();
+        return 0;
+    }
+    if (tag == EV_TAG_ZYGOTE) {
+        evl.remote_done = 0;
+        zygote_collect(0, NULL);
+        return evl.remote_done ? EV_JOBS : 0;
+    }
+    // A pidfd: the child has exited and is waiting to be reaped
+    if (pid == evl.fg_pid) {
+        if (wait4(pid, &status, WNOHANG, &ru) == pid) ev_other_child(pid, status, &ru);
+        return 0;
+    }
+    struct job *j = job_by_pid(pid);
+    if (j && wait4(pid, &status, WNOHANG, &ru) == pid) {
+        job_finish(j, status, &ru);
+        return EV_JOBS;
+    }
+    return 0;
+}
+
+// Waits until something the caller cares about happens. With want_input the
+// input descriptor is watched too and EV_INPUT means one read() won't block.
+static inline int event_loop_wait(int want_input) {
+    struct epoll_event events[EV_MAX_EVENTS];
+    int timeout = -1;
+    if (want_input && evl.input_fd >= 0 && !evl.input_pollable)
+        timeout = 0;  // a regular file is always ready, just handle what is pending
+    if (want_input && evl.input_pollable && !evl.input_armed) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT };
+        ev.data.u64 = EV_TAG_INPUT << 32;
+        epoll_ctl(evl.epoll_fd, EPOLL_CTL_MOD, evl.input_fd, &ev);
+        evl.input_armed = 1;
+    }
+    while (1) {
+        int n = epoll_wait(evl.epoll_fd, events, EV_MAX_EVENTS, timeout);
+        if (n == -1 && errno != EINTR) {
+            perror("epoll_wait");
+            return EV_INPUT;  // let the caller read and find out
+        }
+        int result = 0;
+        for (int i = 0; i < n; i++) {
+            int r = ev_dispatch(&events[i]);
+            // Input wins, then an interrupt, then finished jobs
+            if (r == EV_INPUT || (r == EV_INTERRUPT && result != EV_INPUT) || (r && !result))
+                result = r;
+        }
+        if (timeout == 0) return EV_INPUT;
+        if (result == EV_INPUT && !want_input) result = 0;
+        if (result) return result;
+        if (!want_input && evl.fg_done) return 0;
+    }
+}
+
+// Waits for the foreground command while background jobs keep being reaped.
+// remote: the zygote started it and reports its exit. Returns its wait
+// status, its rusage is left in evl.fg_usage
+static inline int wait_foreground(pid_t pid, int remote) {
+    evl.fg_pid = pid;
+    evl.fg_started = stats_now_ns();
+    evl.fg_done = 0;
+    int fd = -2;    // -2: nothing to watch but the zygote socket, or already done
+    struct ev_exit e;
+    if (ev_take_early(pid, &e)) {
+        // Reaped or reported while an earlier command was waited for
+        ev_other_child(pid, e.status, &e.usage);
+    } else if (!remote) {
+        fd = ev_pidfd_open(pid);
+        if (fd == -1 || ev_add(fd, EPOLLIN, EV_TAG_PIDFD, pid) == -1) {
+            // No pidfd: the SIGCHLD fallback reaps it through jobs_reap(). It
+            // may have exited already, its SIGCHLD handled when nothing was
+            // unwatched, so look once now
+            if (fd != -1) close(fd);
+            fd = -1;
+            evl.unwatched++;
+            ev_reap();
+        }
+    }
+    while (!evl.fg_done)
+        event_loop_wait(0);  // Ctrl-C reaches the child directly, the shell ignores it here
+    if (fd >= 0) close(fd);
+    else if (fd == -1) evl.unwatched--;
+    evl.fg_pid = 0;
+    return evl.fg_status;
+}
+
+#endif
@@ -0,0 +1,267 @@
+/*
+*  expand.h: $VAR and ${VAR} expansion through compiled templates
+*  A line is compiled once into a template: literal spans of a private copy
+*  of the line and variable slots, each slot remembering where its variable
+*  sits in the var_table (entries never move to another number, see vars.h).
+*  Templates are cached by line text, so a line that runs again (a loop in a
+*  script) is expanded by copying spans and values, with no rescanning and
+*  no name lookups. The result goes to a growable buffer, never truncated.
+*     TPL_WORDS  the line is lexed (see lexer.h) and every word becomes one
+*                argument; slots go exactly where the lexer found a $NAME
+*                that was neither in single quotes nor escaped
+*     TPL_RAW    the text is kept as it is and becomes a single string,
+*                $ inside single quotes is left alone (builtin arguments)
+*  A variable that is not set expands to its own text, e.g. "$NAME".
+*/
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include "vars.h"
+#include "lexer.h"
+
+#define EXPAND_CACHE_MAX 4096   // templates kept before the cache starts over
+
+enum tpl_mode { TPL_WORDS, TPL_RAW };
+enum tpl_part_type { TPL_TEXT, TPL_VAR, TPL_END };
+
+struct tpl_part {
+    uint8_t type;       // enum tpl_part_type, TPL_END closes an argument
+    uint32_t len;
+    const char *text;   // literal text, or "$NAME" as written for TPL_VAR
+    const char *name;   // TPL_VAR: NUL terminated variable name
+    uint32_t var;       // TPL_VAR: var_table entry + 1 once found, 0 before
+};
+
+struct template {
+    char *key;          // the source line
+    uint32_t hash;
+    uint8_t mode;
+    char *text;         // copy of the line the parts point into, then the names
+    struct tpl_part *parts;
+    size_t count, cap;
+    int argc;
+};
+
+struct expand_cache {
+    struct template **slots;    // open addressing on (line, mode)
+    size_t count, size;         // size is a power of two
+    char *buf;                  // expansion output
+    size_t buf_cap;
+    uint64_t hits, misses;
+};
+
+static inline uint32_t tpl_hash(const char *s, int mode) {
+    uint32_t h = var_hash(s);
+    return h ^ (uint32_t)mode * 0x9e3779b9u;
+}
+
+static inline struct tpl_part *tpl_add(struct template *t, uint8_t type, const char *text, size_t len) {
+    if (t->count == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 8;
+        t->parts = realloc(t->parts, t->cap * sizeof(*t->parts));
+    }
+    struct tpl_part *part = &t->parts[t->count++];
+    part->type = type;
+    part->text = text;
+    part->len = len;
+    part->name = NULL;
+    part->var = 0;
+    return part;
+}
+
+// Adds the variable part for ref, "$NAME" or "${NAME}" as written, the name
+// is copied to *names
+static inline void tpl_add_var(struct template *t, const char *ref, size_t len, char **names) {
+    const char *name = ref + 1;
+    size_t n = len - 1;
+    if (*name == '{') {
+        name++;
+        n -= 2;
+    }
+    struct tpl_part *part = tpl_add(t, TPL_VAR, ref, len);
+    memcpy(*names, name, n);
+    part->name = *names;
+    *names += n;
+    *(*names)++ = '\0';
+}
+
+// Compiles s (TPL_RAW) as one argument, $ inside single quotes is left alone
+static inline void tpl_compile_raw(struct template *t, char *s, char **names) {
+    const char *lit = s, *p = s;
+    int in_single = 0, in_double = 0;
+    for (; *p; p++) {
+        if (*p == '"' && !in_single) in_double = !in_double;
+        if (*p == '\'' && !in_double) in_single = !in_single;
+        size_t n = *p == '$' && !in_single ? lex_var_len(p) : 0;
+        if (n == 0) continue;     // "$" alone or "${}" stays text
+        if (p > lit) tpl_add(t, TPL_TEXT, lit, p - lit);
+        tpl_add_var(t, p, n, names);
+        lit = p + n;
+        p += n - 1;
+    }
+    if (p > lit) tpl_add(t, TPL_TEXT, lit, p - lit);
+    tpl_add(t, TPL_END, NULL, 0);
+    t->argc++;
+}
+
+// Builds the template of line, NULL if it does not lex
+static inline struct template *tpl_compile(const char *line, int mode, uint32_t hash) {
+    static struct token_list tokens;
+    size_t len = strlen(line);
+    struct template *t = calloc(1, sizeof(*t));
+    t->key = strdup(line);
+    t->hash = hash;
+    t->mode = mode;
+    t->text = malloc(2 * len + 2);  // the line, then names (never longer than it)
+    memcpy(t->text, line, len + 1);
+    char *names = t->text + len + 1;
+    if (mode == TPL_RAW) {
+        tpl_compile_raw(t, t->text, &names);
+        return t;
+    }
+    if (lex_line(t->text, &tokens) == -1) {
+        free(t->key);
+        free(t->text);
+        free(t);
+        return NULL;
+    }
+    // The lexer's $ positions are in line order, so one cursor serves all words
+    const struct lex_dollar *d = tokens.dollars, *last = d + tokens.dollar_count;
+    for (size_t i = 0; i < tokens.count; i++) {
+        const struct token *tok = &tokens.tokens[i];
+        const char *lit = tok->text, *end = tok->text + tok->len;
+        for (; (tok->flags & TOKEN_DOLLAR) && d < last && d->at < end; d++) {
+            if (d->at > lit) tpl_add(t, TPL_TEXT, lit, d->at - lit);
+            tpl_add_var(t, d->at, d->len, &names);
+            lit = d->at + d->len;
+        }
+        if (end > lit) tpl_add(t, TPL_TEXT, lit, end - lit);
+        tpl_add(t, TPL_END, NULL, 0);
+        t->argc++;
+    }
+    return t;
+}
+
+static inline void tpl_free(struct template *t) {
+    free(t->key);
+    free(t->text);
+    free(t->parts);
+    free(t);
+}
+
+static inline void expand_cache_clear(struct expand_cache *c) {
+    for (size_t i = 0; i < c->size; i++)
+        if (c->slots[i]) tpl_free(c->slots[i]);
+    free(c->slots);
+    c->slots = NULL;
+    c->count = c->size = 0;
+}
+
+static inline void expand_cache_free(struct expand_cache *c) {
+    expand_cache_clear(c);
+    free(c->buf);
+    c->buf = NULL;
+    c->buf_cap = 0;
+}
+
+// The template of line, compiled on first use. NULL for a line that does
+// not lex (the lexer has reported it)
+static inline struct template *expand_cache_get(struct expand_cache *c, const char *line, int mode) {
+    uint32_t hash = tpl_hash(line, mode);
+    size_t i = 0;
+    if (c->size) {
+        for (i = hash & (c->size - 1); c->slots[i]; i = (i + 1) & (c->size - 1)) {
+            struct template *t = c->slots[i];
+            if (t->hash == hash && t->mode == mode && strcmp(t->key, line) == 0) {
+                c->hits++;
+                return t;
+            }
+        }
+    }
+    c->misses++;
+    struct template *t = tpl_compile(line, mode, hash);
+    if (t == NULL) return NULL;
+    // Full: start over rather than track ages, a loop body refills it at once
+    if (c->count >= EXPAND_CACHE_MAX) expand_cache_clear(c);
+    if (c->size == 0 || (c->count + 1) * 2 > c->size) {
+        struct expand_cache grown = { .size = c->size ? c->size * 2 : 64 };
+        grown.slots = calloc(grown.size, sizeof(*grown.slots));
+        for (size_t k = 0; k < c->size; k++) {
+            struct template *old = c->slots[k];
+            if (old == NULL) continue;
+            size_t j = old->hash & (grown.size - 1);
+            while (grown.slots[j]) j = (j + 1) & (grown.size - 1);
+            grown.slots[j] = old;
+        }
+        free(c->slots);
+        c->slots = grown.slots;
+        c->size = grown.size;
+    }
+    for (i = hash & (c->size - 1); c->slots[i]; i = (i + 1) & (c->size - 1));
+    c->slots[i] = t;
+    c->count++;
+    return t;
+}
+
+static inline void expand_reserve(struct expand_cache *c, size_t need) {
+    if (need <= c->buf_cap) return;
+    size_t cap = c->buf_cap ? c->buf_cap : 256;
+    while (cap < need) cap *= 2;
+    c->buf = realloc(c->buf, cap);
+    c->buf_cap = cap;
+}
+
+// Evaluates t against vars into c->buf. Sets up to max - 1 entries of argv
+// (NULL terminated) to the expanded arguments when argv is given. Returns the
+// number of arguments, the strings stay valid until the next expansion
+static inline int template_expand(struct expand_cache *c, struct template *t, struct var_table *vars,
+                                  char **argv, int max) {
+    size_t len = 0;
+    int argc = 0;
+    if (argv && max > 1) argv[0] = 0;   // offsets into c->buf until the end, it may move
+    for (size_t i = 0; i < t->count; i++) {
+        struct tpl_part *part = &t->parts[i];
+        const char *s = part->text;
+        size_t n = part->len;
+        if (part->type == TPL_END) {
+            expand_reserve(c, len + 1);
+            c->buf[len++] = '\0';
+            argc++;
+            if (argv && argc < max - 1) argv[argc] = (char *)(uintptr_t)len;
+            continue;
+        }
+        if (part->type == TPL_VAR) {
+            if (part->var == 0) {
+                struct var *v = var_find(vars, part->name);
+                if (v) part->var = v - vars->vars + 1;
+            }
+            if (part->var) {
+                s = vars->vars[part->var - 1].value;
+                n = strlen(s);
+            }
+        }
+        expand_reserve(c, len + n);
+        memcpy(c->buf + len, s, n);
+        len += n;
+    }
+    if (argv) {
+        if (argc > max - 1) argc = max - 1;
+        for (int i = 0; i < argc; i++) argv[i] = c->buf + (uintptr_t)argv[i];
+        argv[argc] = NULL;
+    }
+    return argc;
+}
+
+// Expands text once as a single TPL_RAW string
+static inline char *expand_raw(struct expand_cache *c, const char *text, struct var_table *vars) {
+    struct template *t = expand_cache_get(c, text, TPL_RAW);
+    template_expand(c, t, vars, NULL, 0);
+    return c->buf;
+}
+
+#endif
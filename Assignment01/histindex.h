@@ -0,0 +1,168 @@
+/*
+*  histindex.h: trigram index for searching the command history
+*  Every entry of the history ring is broken into its 3 byte substrings and
+*  its entry number is appended to one posting list per trigram (hashed into
+*  HIST_INDEX_BUCKETS lists). Entry numbers only grow, so every list is sorted.
+*  A substring query intersects the posting lists of the pattern's trigrams
+*  from the newest entry backwards (leapfrog join with binary search skips)
+*  and confirms each common entry with memmem(). Hash collisions only add
+*  candidates that memmem() then rejects.
+*  The index is brought up to date on each search, so adding a command costs
+*  nothing extra and the index only ever indexes entries once. Entries that
+*  fell off the ring are skipped and trimmed from a list when it has to grow.
+*  Patterns shorter than 3 bytes fall back to a scan from the newest entry.
+*/
+#ifndef HISTINDEX_H
+#define HISTINDEX_H
+
+#include <stdint.h>
+#include <string.h>
+#include "history.h"
+
+#define HIST_INDEX_BUCKETS (1 << 18)
+#define HIST_INDEX_MAX_TERMS 16   // trigrams of a long pattern used for the join
+
+struct posting_list {
+    uint32_t *ids;      // entry numbers, ascending
+    uint32_t n, cap;
+};
+
+struct hist_index {
+    struct posting_list *lists;
+    size_t next;        // first entry number not indexed yet
+};
+
+static struct hist_index hindex;
+
+static inline uint32_t trigram_bucket(const unsigned char *p) {
+    uint32_t t = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    return (t * 2654435761u) >> (32 - 18);
+}
+
+static inline void posting_add(struct posting_list *pl, uint32_t id, size_t first) {
+    if (pl->n && pl->ids[pl->n - 1] == id) return;  // trigram repeated in the same entry
+    if (pl->n == pl->cap) {
+        // Drop entries that left the ring before growing
+        uint32_t stale = 0;
+        while (stale < pl->n && pl->ids[stale] < first) stale++;
+        if (stale > pl->n / 2) {
+            memmove(pl->ids, pl->ids + stale, (pl->n - stale) * sizeof(uint32_t));
+            pl->n -= stale;
+        } else {
+            pl->cap = pl->cap ? pl->cap * 2 : 4;
+            pl->ids = realloc(pl->ids, pl->cap * sizeof(uint32_t));
+        }
+    }
+    pl->ids[pl->n++] = id;
+}
+
+// Indexes the entries added since the last search
+static inline void hist_index_update(void) {
+    size_t first = history_first(), total = history_count();
+    if (hindex.lists == NULL)
+        hindex.lists = calloc(HIST_INDEX_BUCKETS, sizeof(struct posting_list));
+    if (hindex.next < first) hindex.next = first;
+    for (; hindex.next <= total; hindex.next++) {
+        size_t len = 0;
+        const unsigned char *text = (const unsigned char *)history_get(hindex.next, &len);
+        for (size_t i = 0; i + 3 <= len; i++)
+            posting_add(&hindex.lists[trigram_bucket(text + i)], hindex.next, first);
+    }
+}
+
+// Position just past the largest id <= id in ids[0..end), 0 if there is none
+static inline uint32_t posting_seek(const struct posting_list *pl, uint32_t end, uint32_t id) {
+    uint32_t lo = 0, hi = end;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (pl->ids[mid] <= id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static inline int hist_entry_matches(size_t n, const char *pattern, size_t plen) {
+    size_t len = 0;
+    const char *text = history_get(n, &len);
+    return text && memmem(text, len, pattern, plen) != NULL;
+}
+
+// Calls found(n) for every entry containing pattern, newest first, until
+// found returns 0 or limit matches were reported (0 = no limit).
+// Returns the number of matches reported.
+static inline size_t history_search(const char *pattern, size_t limit, int (*found)(size_t)) {
+    size_t plen = strlen(pattern), matches = 0;
+    size_t first = history_first(), total = history_count();
+
+    if (plen < 3) {
+        for (size_t n = total; n >= first && n > 0; n--) {
+            if (hist_entry_matches(n, pattern, plen)) {
+                matches++;
+                if (!found(n) || matches == limit) break;
+            }
+        }
+        return matches;
+    }
+
+    hist_index_update();
+    // Leapfrog join of the pattern's posting lists, walking down from the newest
+    // entry: each list in turn skips to the largest id <= the current candidate,
+    // a candidate every list agrees on is checked with memmem()
+    size_t k = plen - 2 < HIST_INDEX_MAX_TERMS ? plen - 2 : HIST_INDEX_MAX_TERMS;
+    struct posting_list *lists[HIST_INDEX_MAX_TERMS];
+    uint32_t end[HIST_INDEX_MAX_TERMS];
+    for (size_t i = 0; i < k; i++) {
+        lists[i] = &hindex.lists[trigram_bucket((const unsigned char *)pattern + i * (plen - 3) / (k > 1 ? k - 1 : 1))];
+        end[i] = lists[i]->n;
+    }
+    uint32_t candidate = UINT32_MAX;
+    size_t agree = 0;
+    for (size_t i = 0;; i = (i + 1) % k) {
+        end[i] = posting_seek(lists[i], end[i], candidate);
+        if (end[i] == 0) break;
+        uint32_t id = lists[i]->ids[end[i] - 1];
+        if (id < first) break;
+        if (id != candidate) {
+            candidate = id;
+            agree = 0;
+        }
+        if (++agree < k) continue;
+        if (hist_entry_matches(candidate, pattern, plen)) {
+            matches++;
+            if (!found(candidate) || matches == limit) break;
+        }
+        if (candidate == 0) break;
+        candidate--;
+        agree = 0;
+    }
+    return matches;
+}
+
+static size_t hist_latest_match;
+
+static inline int hist_keep_match(size_t n) {
+    hist_latest_match = n;
+    return 0;
+}
+
+// Number of the newest entry containing pattern, 0 if there is none (for !?substr)
+static inline size_t history_search_latest(const char *pattern) {
+    hist_latest_match = 0;
+    history_search(pattern, 1, hist_keep_match);
+    return hist_latest_match;
+}
+
+static inline int hist_print_match(size_t n) {
+    size_t len = 0;
+    const char *text = history_get(n, &len);
+    printf("%5zu  %.*s\n", n, (int)len, text);
+    return 1;
+}
+
+// "history search <pattern>": lists the matching entries, newest first
+static inline void history_search_print(const char *pattern) {
+    if (history_search(pattern, 0, hist_print_match) == 0)
+        printf("history: no match for '%s'\n", pattern);
+}
+
+#endif
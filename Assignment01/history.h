@@ -0,0 +1,164 @@
+/*
+*  history.h: ring buffer command history with a persistent history file
+*  Entries are kept in a ring of HISTSIZE slots (default 100000), so adding
+*  a command is O(1) whatever the size and "!N" / "!-N" are a single index
+*  computation. A slot is only a pointer and a length: commands typed in this
+*  session are malloc'ed at their exact size, commands from earlier sessions
+*  point straight into the mmapped history file.
+*  Every command is appended to the file ($HISTFILE, default ~/.pucit_history)
+*  as it is added. The shells only add commands typed at a terminal, never
+*  the lines of -c or a script. The file is only mmapped and indexed the first time the
+*  history is actually looked at, so a large file costs nothing at startup.
+*  Entry numbers are absolute, as in bash: entry 1 is the oldest line of the
+*  file and numbers keep growing when old entries fall off the ring.
+*/
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HISTORY_DEFAULT_SIZE 100000
+#define HISTORY_FILE_NAME ".pucit_history"
+
+struct history_entry {
+    const char *text;   // not NUL terminated
+    uint32_t len;
+    uint32_t owned;     // malloc'ed in this session, otherwise inside the map
+};
+
+struct history {
+    struct history_entry *ring;
+    size_t size;        // number of slots
+    size_t total;       // entries ever added, entry n (1 based) is in slot (n-1) % size
+    int fd;             // history file opened for appending, -1 if none
+    char *file;         // path of the history file, NULL when history is not saved
+    char *map;          // mmapped file contents from before loading
+    size_t map_len;
+    int loaded;         // file has been indexed into the ring
+    int ready;          // history_init() done
+};
+
+static struct history hist = { .fd = -1 };
+
+// Reads HISTSIZE and HISTFILE, opens nothing yet
+static inline void history_init(void) {
+    if (hist.ready) return;
+    const char *size = getenv("HISTSIZE");
+    hist.size = size && atol(size) > 0 ? (size_t)atol(size) : HISTORY_DEFAULT_SIZE;
+    const char *file = getenv("HISTFILE");
+    const char *home = getenv("HOME");
+    if (file && *file) {
+        hist.file = strdup(file);
+    } else if (home) {
+        hist.file = malloc(strlen(home) + sizeof(HISTORY_FILE_NAME) + 1);
+        sprintf(hist.file, "%s/%s", home, HISTORY_FILE_NAME);
+    }
+    hist.ready = 1;
+}
+
+static inline void history_store(const char *text, size_t len, int owned) {
+    struct history_entry *e = &hist.ring[hist.total % hist.size];
+    if (e->owned) free((char *)e->text);
+    e->text = text;
+    e->len = len;
+    e->owned = owned;
+    hist.total++;
+}
+
+// Maps the history file and indexes its lines, only the last hist.size of them
+// end up in the ring. Called on the first lookup, not at startup.
+static inline void history_load(void) {
+    history_init();
+    if (hist.loaded) return;
+    hist.loaded = 1;
+    hist.ring = calloc(hist.size, sizeof(*hist.ring));
+    if (hist.file == NULL) return;
+    int fd = open(hist.file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        hist.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (hist.map == MAP_FAILED) {
+            hist.map = NULL;
+        } else {
+            hist.map_len = st.st_size;
+            const char *p = hist.map, *end = hist.map + hist.map_len;
+            while (p < end) {
+                const char *nl = memchr(p, '\n', end - p);
+                if (nl == NULL) break;  // partial last line (writer still busy)
+                history_store(p, nl - p, 0);
+                p = nl + 1;
+            }
+        }
+    }
+    close(fd);
+}
+
+// Adds a command: one write() to the file and, once loaded, one ring slot
+static inline void history_add(const char *command) {
+    size_t len = strlen(command);
+    history_init();
+    if (hist.fd == -1 && hist.file)
+        hist.fd = open(hist.file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (hist.fd != -1) {
+        // Each line goes out in a single O_APPEND write so shells sharing the file don't interleave
+        char *line = malloc(len + 1);
+        memcpy(line, command, len);
+        line[len] = '\n';
+        if (write(hist.fd, line, len + 1) != (ssize_t)(len + 1)) {
+            close(hist.fd);
+            hist.fd = -1;
+            free(hist.file);
+            hist.file = NULL;  // stop saving, keep the history in memory
+        }
+        free(line);
+    }
+    if (hist.loaded || hist.fd == -1) {
+        // Without a file the history can't be reloaded later, keep it in memory now
+        history_load();
+        char *copy = malloc(len ? len : 1);
+        memcpy(copy, command, len);
+        history_store(copy, len, 1);
+    }
+}
+
+// Number of the newest entry, also the count of entries ever added
+static inline size_t history_count(void) {
+    history_load();
+    return hist.total;
+}
+
+// Number of the oldest entry still in the ring
+static inline size_t history_first(void) {
+    history_load();
+    return hist.total > hist.size ? hist.total - hist.size + 1 : 1;
+}
+
+// Returns entry n (1 based) and its length, NULL if it is no longer in the ring
+static inline const char *history_get(size_t n, size_t *len) {
+    history_load();
+    if (n < history_first() || n > hist.total) return NULL;
+    struct history_entry *e = &hist.ring[(n - 1) % hist.size];
+    *len = e->len;
+    return e->text;
+}
+
+// Prints the last count entries (all of them when count is 0) with their numbers
+static inline void history_print(size_t count) {
+    size_t first = history_first();
+    if (count && hist.total - first + 1 > count) first = hist.total - count + 1;
+    for (size_t n = first; n <= hist.total; n++) {
+        size_t len = 0;
+        const char *text = history_get(n, &len);
+        printf("%5zu  %.*s\n", n, (int)len, text);
+    }
+}
+
+#endif
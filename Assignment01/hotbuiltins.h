@@ -0,0 +1,224 @@
+/*
+*  hotbuiltins.h: echo, true, false, pwd, test/[ and printf inside the shell
+*  These make up most of a typical script and each used to cost a process.
+*  Run as builtins they are a function call; redirections and pipes still
+*  work because the shell switches its own stdin/stdout around them (see
+*  redirect.h and start_pipeline()). "command echo ..." still runs the
+*  external binary. A builtin handler has no return value, so the exit
+*  status goes to builtin_status, which the caller resets to 0 before every
+*  call.
+*/
+#ifndef HOTBUILTINS_H
+#define HOTBUILTINS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "builtins.h"
+
+static int builtin_status;     // exit status of the builtin that just ran
+
+static inline void builtin_echo(char **args, char *rest) {
+    int i = 1, newline = 1;
+    if (args[1] && strcmp(args[1], "-n") == 0) {
+        newline = 0;
+        i = 2;
+    }
+    for (int first = i; args[i]; i++) {
+        if (i > first) putchar(' ');
+        fputs(args[i], stdout);
+    }
+    if (newline) putchar('\n');
+}
+
+static inline void builtin_true(char **args, char *rest) {
+    builtin_status = 0;
+}
+
+static inline void builtin_false(char **args, char *rest) {
+    builtin_status = 1;
+}
+
+static inline void builtin_pwd(char **args, char *rest) {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("pwd");
+        builtin_status = 1;
+        return;
+    }
+    puts(cwd);
+}
+
+// Unary file and string tests of test(1)
+static inline int test_unary(const char *op, const char *arg, int *result) {
+    struct stat st;
+    if (op[0] != '-' || op[1] == '\0' || op[2] != '\0') return -1;
+    switch (op[1]) {
+    case 'n': *result = arg[0] != '\0'; return 0;
+    case 'z': *result = arg[0] == '\0'; return 0;
+    case 'e': *result = stat(arg, &st) == 0; return 0;
+    case 'f': *result = stat(arg, &st) == 0 && S_ISREG(st.st_mode); return 0;
+    case 'd': *result = stat(arg, &st) == 0 && S_ISDIR(st.st_mode); return 0;
+    case 's': *result = stat(arg, &st) == 0 && st.st_size > 0; return 0;
+    case 'r': *result = access(arg, R_OK) == 0; return 0;
+    case 'w': *result = access(arg, W_OK) == 0; return 0;
+    case 'x': *result = access(arg, X_OK) == 0; return 0;
+    }
+    return -1;
+}
+
+static inline int test_binary(const char *a, const char *op, const char *b, int *result) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) *result = strcmp(a, b) == 0;
+    else if (strcmp(op, "!=") == 0) *result = strcmp(a, b) != 0;
+    else {
+        static const char *ops[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+        int k = 0;
+        while (k < 6 && strcmp(op, ops[k]) != 0) k++;
+        if (k == 6) return -1;
+        char *end_a, *end_b;
+        long long x = strtoll(a, &end_a, 10), y = strtoll(b, &end_b, 10);
+        if (*a == '\0' || *end_a || *b == '\0' || *end_b) {
+            fprintf(stderr, "test: integer expression expected\n");
+            return -2;
+        }
+        int r[6] = { x == y, x != y, x < y, x <= y, x > y, x >= y };
+        *result = r[k];
+    }
+    return 0;
+}
+
+// test EXPR and [ EXPR ], the POSIX rules by number of arguments (up to 4)
+static inline void builtin_test(char **args, char *rest) {
+    int argc = 0;
+    while (args[argc]) argc++;
+    if (strcmp(args[0], "[") == 0) {
+        if (argc < 2 || strcmp(args[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            builtin_status = 2;
+            return;
+        }
+        argc--;
+    }
+    char **a = args + 1;
+    int n = argc - 1, negate = 0, result = 0, err = 0;
+    if (n > 0 && n != 3 && strcmp(a[0], "!") == 0) {
+        negate = 1;
+        a++;
+        n--;
+    }
+    switch (n) {
+    case 0: result = 0; break;
+    case 1: result = a[0][0] != '\0'; break;
+    case 2: err = test_unary(a[0], a[1], &result); break;
+    case 3:
+        err = test_binary(a[0], a[1], a[2], &result);
+        if (err == -1 && strcmp(a[0], "!") == 0) {
+            negate = 1;
+            err = test_unary(a[1], a[2], &result);
+        }
+        break;
+    default: err = -1;
+    }
+    if (err == -1) fprintf(stderr, "test: unsupported expression\n");
+    builtin_status = err ? 2 : (result ^ negate) ? 0 : 1;
+}
+
+// Writes s with the backslash escapes of printf(1) formats
+static inline const char *printf_escape(const char *s) {
+    switch (*++s) {
+    case 'n': putchar('\n'); break;
+    case 't': putchar('\t'); break;
+    case 'r': putchar('\r'); break;
+    case 'a': putchar('\a'); break;
+    case '\\': putchar('\\'); break;
+    case '0': {
+        int c = 0, k = 0;
+        while (k < 3 && s[1] >= '0' && s[1] <= '7') c = c * 8 + (*++s - '0'), k++;
+        putchar(c);
+        break;
+    }
+    case '\0': putchar('\\'); return s;
+    default: putchar('\\'); putchar(*s); break;
+    }
+    return s + 1;
+}
+
+// printf FORMAT [ARG...]: %s %c %d %i %u %o %x %X %% with flags, width and
+// precision; the format is reused while arguments are left
+static inline void builtin_printf(char **args, char *rest) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "printf: missing format\n");
+        builtin_status = 2;
+        return;
+    }
+    const char *format = args[1];
+    char **arg = args + 2;
+    do {
+        int used = 0;
+        for (const char *f = format; *f;) {
+            if (*f == '\\') {
+                f = printf_escape(f);
+                continue;
+            }
+            if (*f != '%') {
+                putchar(*f++);
+                continue;
+            }
+            if (f[1] == '%') {
+                putchar('%');
+                f += 2;
+                continue;
+            }
+            // Copy "%[flags][width][.precision]" and add the length modifier
+            char spec[32];
+            size_t k = 0;
+            spec[k++] = *f++;
+            while (*f && strchr("-+ #0123456789.", *f) && k < sizeof(spec) - 4) spec[k++] = *f++;
+            char conv = *f ? *f++ : 's';
+            const char *value = *arg ? *arg++ : NULL;
+            used = 1;
+            switch (conv) {
+            case 'd': case 'i':
+                spec[k++] = 'l'; spec[k++] = 'l'; spec[k++] = 'd'; spec[k] = '\0';
+                printf(spec, value ? strtoll(value, NULL, 0) : 0LL);
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                spec[k++] = 'l'; spec[k++] = 'l'; spec[k++] = conv; spec[k] = '\0';
+                printf(spec, value ? strtoull(value, NULL, 0) : 0ULL);
+                break;
+            case 'c':
+                spec[k++] = 'c'; spec[k] = '\0';
+                printf(spec, value ? value[0] : '\0');
+                break;
+            default:
+                spec[k++] = 's'; spec[k] = '\0';
+                printf(spec, value ? value : "");
+                break;
+            }
+        }
+        if (!used) break;
+    } while (*arg);
+}
+
+// Whether b is one of the builtins above. They only print or test, so one
+// of them can run in the shell as a stage of a pipeline; any other builtin
+// there (cd, exit, kill, ...) would change the shell itself
+static inline int builtin_is_hot(const struct builtin *b) {
+    return b->fn == builtin_echo || b->fn == builtin_true || b->fn == builtin_false || b->fn == builtin_pwd ||
+           b->fn == builtin_test || b->fn == builtin_printf;
+}
+
+static inline void register_hot_builtins(void) {
+    builtin_register("echo", builtin_echo, "echo [-n] [text...]: Print the arguments.");
+    builtin_register("true", builtin_true, NULL);
+    builtin_register("false", builtin_false, NULL);
+    builtin_register("pwd", builtin_pwd, "pwd: Print the working directory.");
+    builtin_register("test", builtin_test, "test <expr>, [ <expr> ]: Evaluate a condition.");
+    builtin_register("[", builtin_test, NULL);
+    builtin_register("printf", builtin_printf, "printf <format> [args...]: Print formatted text.");
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*
+*  input.h: buffered command reader shared by every shell version
+*  Commands are read with read() in large blocks and handed out one line at a
+*  time straight from the block buffer, so a generated script with 100k lines
+*  costs a few dozen read syscalls instead of one getc()/fgets() per line.
+*  Lines have no length limit: the buffer grows when a line does not fit.
+*  The prompt is printed only when commands come from a terminal.
+*  reader_from_args() handles the common command line:
+*     shell              interactive, or batch when stdin is not a tty
+*     shell -c "cmds"    run the given commands (newline separated) and exit
+*     shell script.txt   run the commands of a script file and exit
+*/
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define READER_BLOCK (64 * 1024)   // bytes asked for by every read()
+
+struct line_reader {
+    int fd;             // descriptor commands come from, -1 for a -c string
+    char *buf;          // block buffer, lines are returned in place
+    size_t pos;         // start of the first line not handed out yet
+    size_t len;         // bytes of valid data in buf
+    size_t cap;         // allocated size, always > len so a NUL fits
+    int interactive;    // print prompts
+    int eof;            // no more data will arrive
+};
+
+// Both initializers return 0, or -1 (after printing why) when the buffer
+// cannot be allocated
+static inline int reader_init_fd(struct line_reader *r, int fd) {
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->cap = READER_BLOCK + 1;
+    r->buf = malloc(r->cap);
+    r->interactive = isatty(fd);
+    if (r->buf == NULL) {
+        perror("reader");
+        return -1;
+    }
+    return 0;
+}
+
+// Commands given with -c, the string is the whole input
+static inline int reader_init_string(struct line_reader *r, const char *cmds) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->buf = strdup(cmds);
+    r->len = strlen(cmds);
+    r->cap = r->len + 1;
+    r->eof = 1;
+    if (r->buf == NULL) {
+        perror("reader");
+        return -1;
+    }
+    return 0;
+}
+
+// Sets up the reader from the shell's arguments starting at argv[first].
+// Returns -1 (after printing why) when the script cannot be opened.
+static inline int reader_from_args(struct line_reader *r, int argc, char *argv[], int first) {
+    if (first < argc && strcmp(argv[first], "-c") == 0) {
+        if (first + 1 >= argc) {
+            fprintf(stderr, "%s: -c: option requires an argument\n", argv[0]);
+            return -1;
+        }
+        return reader_init_string(r, argv[first + 1]);
+    }
+    if (first < argc) {
+        int fd = open(argv[first], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror(argv[first]);
+            return -1;
+        }
+        if (reader_init_fd(r, fd) == -1) {
+            close(fd);
+            return -1;
+        }
+        r->interactive = 0;  // scripts never prompt
+        return 0;
+    }
+    return reader_init_fd(r, STDIN_FILENO);
+}
+
+static inline void reader_close(struct line_reader *r) {
+    if (r->fd > STDIN_FILENO) close(r->fd);
+    free(r->buf);
+    r->buf = NULL;
+}
+
+// Returns the next complete line already in the buffer (newline removed), or
+// NULL when more data has to be read first. Never blocks.
+static inline char *reader_next(struct line_reader *r) {
+    char *line = r->buf + r->pos;
+    char *nl = memchr(line, '\n', r->len - r->pos);
+    if (nl) {
+        *nl = '\0';
+        r->pos = nl - r->buf + 1;
+        return line;
+    }
+    if (r->eof && r->pos < r->len) {
+        // Last line of the input has no newline
+        r->buf[r->len] = '\0';
+        r->pos = r->len;
+        return line;
+    }
+    return NULL;
+}
+
+// Reads one more block into the buffer. Returns the byte count, 0 at end of
+// input and -1 on error (errno set, EINTR/EAGAIN are left to the caller). A
+// buffer that cannot grow is an error too (ENOMEM), the lines in it stay.
+static inline ssize_t reader_fill(struct line_reader *r) {
+    if (r->eof) return 0;
+    // Drop lines already handed out, grow when a single line fills the buffer
+    if (r->pos > 0) {
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+    if (r->cap - r->len - 1 < READER_BLOCK / 2) {
+        char *grown = realloc(r->buf, r->cap * 2);
+        if (grown == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        r->buf = grown;
+        r->cap *= 2;
+    }
+    ssize_t n = read(r->fd, r->buf + r->len, r->cap - r->len - 1);
+    if (n > 0)
+        r->len += n;
+    else if (n == 0)
+        r->eof = 1;
+    return n;
+}
+
+// Prints the prompt (terminals only) and returns the next line, or NULL at
+// the end of the input. The line lives in the reader's buffer and stays
+// valid (and writable) until the next call.
+static inline char *read_line(struct line_reader *r, const char *prompt) {
+    char *line;
+    if (r->interactive && prompt)
+        fputs(prompt, stdout);
+    fflush(stdout);
+    while ((line = reader_next(r)) == NULL) {
+        ssize_t n = reader_fill(r);
+        if (n == 0 && r->pos >= r->len)
+            return NULL;
+        if (n < 0 && errno != EINTR) {
+            perror("read");
+            return NULL;
+        }
+    }
+    return line;
+}
+
+#endif
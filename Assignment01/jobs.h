@@ -0,0 +1,263 @@
+/*
+*  jobs.h: background job table
+*  Jobs are found by pid and by job number through two open addressing hash
+*  indexes and are kept on a doubly linked list in launch order for listing,
+*  so adding, finding and removing a job are all O(1) and there is no cap on
+*  the number of jobs. Job numbers are stable: a job keeps its number until it
+*  has been reported, and numbering starts again at 1 once the table is empty.
+*  Jobs added with job_add_quiet() (the inner stages of a background
+*  pipeline, the commands of "parallel") get no number at all: they are
+*  found by pid only, so "jobs" and "kill N" never reach them by mistake.
+*  Nothing here runs in signal context. jobs_reap() collects every finished
+*  child with one wait4(-1, WNOHANG) loop, job_finish() retires a single job
+*  reaped elsewhere (by pidfd, see evloop.h) and jobs_report() prints the
+*  finished jobs later, from the main loop.
+*/
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+#include "timeouts.h"
+
+// cgroup v2 group made for a background line (cgroup.h). Every job of the
+// line holds a reference, the group is removed with the last of them, when
+// nothing can run in it any more
+struct job_cgroup {
+    int refs;
+    char path[];
+};
+
+struct job {
+    int id;                 // job number shown as [id], 0 for a quiet job
+    pid_t pid;
+    char *command;          // command line as typed
+    int status;             // wait status once done
+    int pidfd;              // pidfd watched by the event loop, -1 if none (closed once done)
+    int owner;              // 0 for a plain background job, else claimed with jobs_take_done()
+    int leader;             // quiet pipeline stage: number of the job of the line's last stage
+    int remote;             // started by the zygote, which reports its exit (zygote.h)
+    double started;         // CLOCK_MONOTONIC seconds at launch
+    double finished;        // CLOCK_MONOTONIC seconds when reaped
+    struct rusage usage;    // from wait4() once done
+    struct job_cgroup *cgroup;  // group it runs in, NULL if none
+    struct timeout timeout; // deadline from "timeout" (timeouts.h), index -1 when none
+    struct job *prev, *next;   // launch order list, or the done list
+};
+
+// Open addressing index from an int key (pid or job number) to a job
+struct job_index {
+    struct job **slots;
+    size_t cap;             // power of two
+    size_t count;
+    int by_pid;             // key is pid, otherwise job number
+};
+
+struct job_table {
+    struct job_index pids, ids;
+    struct job *head, *tail;        // running jobs in launch order
+    struct job *done_head, *done_tail;  // reaped, waiting to be reported
+    size_t count;
+    int next_id;
+};
+
+static struct job_table jobs = { .pids = { .by_pid = 1 }, .next_id = 1 };
+
+static inline double job_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline int job_key(const struct job_index *ix, const struct job *j) {
+    return ix->by_pid ? j->pid : j->id;
+}
+
+static inline size_t job_slot_hash(int key, size_t cap) {
+    return ((uint32_t)key * 2654435761u) & (cap - 1);
+}
+
+static inline void job_index_put(struct job_index *ix, struct job *j) {
+    if ((ix->count + 1) * 2 > ix->cap) {
+        // Keep the index at most half full, rehash into twice the size
+        struct job **old = ix->slots;
+        size_t old_cap = ix->cap;
+        ix->cap = old_cap ? old_cap * 2 : 64;
+        ix->slots = calloc(ix->cap, sizeof(*ix->slots));
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i]) {
+                size_t k = job_slot_hash(job_key(ix, old[i]), ix->cap);
+                while (ix->slots[k]) k = (k + 1) & (ix->cap - 1);
+                ix->slots[k] = old[i];
+            }
+        }
+        free(old);
+    }
+    size_t k = job_slot_hash(job_key(ix, j), ix->cap);
+    while (ix->slots[k]) k = (k + 1) & (ix->cap - 1);
+    ix->slots[k] = j;
+    ix->count++;
+}
+
+static inline size_t job_index_find(const struct job_index *ix, int key) {
+    if (ix->cap == 0) return (size_t)-1;
+    for (size_t k = job_slot_hash(key, ix->cap); ix->slots[k]; k = (k + 1) & (ix->cap - 1)) {
+        if (job_key(ix, ix->slots[k]) == key) return k;
+    }
+    return (size_t)-1;
+}
+
+static inline void job_index_remove(struct job_index *ix, size_t k) {
+    size_t mask = ix->cap - 1;
+    ix->slots[k] = NULL;
+    ix->count--;
+    // Backward shift deletion, no tombstones
+    for (size_t j = (k + 1) & mask; ix->slots[j]; j = (j + 1) & mask) {
+        size_t home = job_slot_hash(job_key(ix, ix->slots[j]), ix->cap);
+        if (((j - home) & mask) >= ((j - k) & mask)) {
+            ix->slots[k] = ix->slots[j];
+            ix->slots[j] = NULL;
+            k = j;
+        }
+    }
+}
+
+static inline struct job *job_insert(pid_t pid, const char *command, int id) {
+    struct job *j = calloc(1, sizeof(*j));
+    j->pid = pid;
+    j->id = id;
+    j->pidfd = -1;
+    j->timeout.index = -1;
+    j->started = job_clock();
+    j->command = strdup(command);
+    job_index_put(&jobs.pids, j);
+    if (id) job_index_put(&jobs.ids, j);
+    j->prev = jobs.tail;
+    if (jobs.tail) jobs.tail->next = j;
+    else jobs.head = j;
+    jobs.tail = j;
+    jobs.count++;
+    return j;
+}
+
+// Adds a running background job with the next job number and returns it
+static inline struct job *job_add(pid_t pid, const char *command) {
+    return job_insert(pid, command, jobs.next_id++);
+}
+
+// Adds a running child without a job number, claimed by owner (non zero)
+// with jobs_take_done() once it is done
+static inline struct job *job_add_quiet(pid_t pid, const char *command, int owner) {
+    struct job *j = job_insert(pid, command, 0);
+    j->owner = owner;
+    return j;
+}
+
+static inline struct job *job_by_pid(pid_t pid) {
+    size_t k = job_index_find(&jobs.pids, pid);
+    return k == (size_t)-1 ? NULL : jobs.pids.slots[k];
+}
+
+static inline struct job *job_by_id(int id) {
+    size_t k = job_index_find(&jobs.ids, id);
+    return k == (size_t)-1 ? NULL : jobs.ids.slots[k];
+}
+
+// Takes a finished job out of the running list and queues it for reporting,
+// ru is what wait4() returned for it
+static inline void job_finish(struct job *j, int status, const struct rusage *ru) {
+    job_index_remove(&jobs.pids, job_index_find(&jobs.pids, j->pid));
+    if (j->prev) j->prev->next = j->next;
+    else jobs.head = j->next;
+    if (j->next) j->next->prev = j->prev;
+    else jobs.tail = j->prev;
+    jobs.count--;
+    timeout_disarm(&j->timeout);
+    j->status = status;
+    j->usage = *ru;
+    j->finished = job_clock();
+    stats_child(ru, (uint64_t)((j->finished - j->started) * 1e9));
+    if (j->pidfd >= 0) close(j->pidfd);  // also drops it from the epoll set
+    j->next = NULL;
+    j->prev = jobs.done_tail;
+    if (jobs.done_tail) jobs.done_tail->next = j;
+    else jobs.done_head = j;
+    jobs.done_tail = j;
+}
+
+// Collects every child that has exited, with wait4() so its resource usage
+// is recorded. Children that are not background jobs (the foreground
+// command) are handed to other_child when it is set.
+static inline void jobs_reap(void (*other_child)(pid_t, int, const struct rusage *)) {
+    int status;
+    pid_t pid;
+    struct rusage ru;
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+        struct job *j = job_by_pid(pid);
+        if (j) job_finish(j, status, &ru);
+        else if (other_child) other_child(pid, status, &ru);
+    }
+}
+
+static inline struct job_cgroup *job_cgroup_new(const char *path) {
+    struct job_cgroup *g = malloc(sizeof(*g) + strlen(path) + 1);
+    g->refs = 0;
+    strcpy(g->path, path);
+    return g;
+}
+
+// Drops one reference to g, removing the group with the last one
+static inline void job_cgroup_put(struct job_cgroup *g) {
+    if (g == NULL || --g->refs > 0) return;
+    rmdir(g->path);
+    free(g);
+}
+
+static inline void job_free(struct job *j) {
+    if (j->id) job_index_remove(&jobs.ids, job_index_find(&jobs.ids, j->id));
+    job_cgroup_put(j->cgroup);
+    free(j->command);
+    free(j);
+}
+
+// Unlinks and returns the oldest finished job with the given owner, NULL if
+// there is none. The caller reports it itself and frees it with job_free().
+static inline struct job *jobs_take_done(int owner) {
+    for (struct job *j = jobs.done_head; j; j = j->next) {
+        if (j->owner != owner) continue;
+        if (j->prev) j->prev->next = j->next;
+        else jobs.done_head = j->next;
+        if (j->next) j->next->prev = j->prev;
+        else jobs.done_tail = j->prev;
+        return j;
+    }
+    return NULL;
+}
+
+// Prints and frees the jobs reaped since the last report
+static inline void jobs_report(void) {
+    struct job *j;
+    while ((j = jobs_take_done(0)) != NULL) {
+        if (WIFSIGNALED(j->status) && j->timeout.fired)
+            printf("[%d] Timed out (signal %d) %s\n", j->id, WTERMSIG(j->status), j->command);
+        else if (WIFSIGNALED(j->status))
+            printf("[%d] Killed (signal %d) %s\n", j->id, WTERMSIG(j->status), j->command);
+        else if (WEXITSTATUS(j->status) != 0)
+            printf("[%d] Exit %d %s\n", j->id, WEXITSTATUS(j->status), j->command);
+        else
+            printf("[%d] Finished %s\n", j->id, j->command);
+        job_free(j);
+    }
+    // Numbers start again from 1 once nothing is left
+    if (jobs.count == 0 && jobs.done_head == NULL) jobs.next_id = 1;
+}
+
+#endif
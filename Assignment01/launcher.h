@@ -0,0 +1,174 @@
+/*
+*  launcher.h: shared command launcher for the PUCIT shells
+*  launch_command() starts an external command with posix_spawn() instead of
+*  fork()+execvp(). glibc implements posix_spawn() with clone(CLONE_VM|CLONE_VFORK),
+*  so the child borrows the parent's address space until it execs and the cost
+*  of starting a command no longer grows with the size of the shell itself
+*  (history, job table, variable store).
+*  The "<" and ">" redirections and the pipe dup2()s of myshellv2.c are applied
+*  through posix_spawn file actions, so the child runs no shell code at all.
+*  Command names are resolved through the PATH hash table (pathhash.h), so the
+*  child does a single execve() instead of one per PATH directory.
+*  Descriptors passed in in_fd/out_fd should be close-on-exec (pipe2(O_CLOEXEC)),
+*  the dup2() onto stdin/stdout clears the flag on the copy only.
+*  A spec with a pre_exec hook (CPU placement, see placement.h) needs code to
+*  run in the child, which posix_spawn() cannot do: those commands are started
+*  with fork() and the hook runs between fork and exec.
+*/
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "pathhash.h"
+#include "stats.h"
+
+extern char **environ;
+
+// Everything needed to start one command
+struct launch_spec {
+    char **argv;              // NULL terminated argument vector, argv[0] is the command
+    char **envp;              // environment for the child, NULL means environ
+    const char *input_file;   // "<" file or NULL
+    const char *output_file;  // ">" file or NULL
+    int in_fd;                // fd to become stdin (e.g. pipe read end), -1 if none
+    int out_fd;               // fd to become stdout (e.g. pipe write end), -1 if none
+    // Runs in the child before exec when set, returns 0 or an errno that
+    // fails the launch
+    int (*pre_exec)(const void *arg);
+    const void *pre_exec_arg;
+};
+
+// Fills a spec with no redirections for the given argument vector
+static inline void launch_spec_init(struct launch_spec *spec, char **argv) {
+    memset(spec, 0, sizeof(*spec));
+    spec->argv = argv;
+    spec->in_fd = spec->out_fd = -1;
+}
+
+// fork() and exec path for a spec with a pre_exec hook. A close-on-exec pipe
+// brings the errno of a failed hook or execve() back, so it fails the same
+// way posix_spawn() does. Returns 0 or that errno
+static inline int launch_fork(pid_t *pid, const char *path, const struct launch_spec *spec,
+                              int in_fd, int out_fd) {
+    int errpipe[2];
+    if (pipe(errpipe) == -1) return errno;
+    fcntl(errpipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(errpipe[1], F_SETFD, FD_CLOEXEC);
+    *pid = fork();
+    if (*pid == -1) {
+        int err = errno;
+        close(errpipe[0]);
+        close(errpipe[1]);
+        return err;
+    }
+    if (*pid == 0) {
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        if (in_fd != -1 && in_fd != STDIN_FILENO) dup2(in_fd, STDIN_FILENO);
+        if (out_fd != -1 && out_fd != STDOUT_FILENO) dup2(out_fd, STDOUT_FILENO);
+        int err = spec->pre_exec(spec->pre_exec_arg);
+        if (err == 0) {
+            execve(path, spec->argv, spec->envp ? spec->envp : environ);
+            err = errno;
+        }
+        ssize_t sent = write(errpipe[1], &err, sizeof(err));
+        _exit(sent == sizeof(err) ? 127 : 126);
+    }
+    close(errpipe[1]);
+    int err = 0;
+    ssize_t n;
+    while ((n = read(errpipe[0], &err, sizeof(err))) == -1 && errno == EINTR);
+    close(errpipe[0]);
+    if (n == sizeof(err)) {
+        waitpid(*pid, NULL, 0);
+        *pid = -1;
+        return err;
+    }
+    return 0;
+}
+
+// Starts the command described by spec and returns its pid, or -1 with an
+// error message printed. Redirection files are opened here in the parent so
+// the error names the file, the same way myshellv2.c reported them.
+static inline pid_t launch_command(const struct launch_spec *spec) {
+    posix_spawn_file_actions_t fa;
+    int in_fd = spec->in_fd, out_fd = spec->out_fd;
+    int opened_in = -1, opened_out = -1;
+    pid_t pid = -1;
+
+    if (spec->input_file) {
+        opened_in = in_fd = open(spec->input_file, O_RDONLY | O_CLOEXEC);
+        if (in_fd == -1) {
+            perror("Error opening input file");
+            return -1;
+        }
+    }
+    if (spec->output_file) {
+        opened_out = out_fd = open(spec->output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out_fd == -1) {
+            perror("Error opening output file");
+            if (opened_in != -1) close(opened_in);
+            return -1;
+        }
+    }
+
+    fflush(stdout);  // anything the shell printed must come before the child's output
+    posix_spawn_file_actions_init(&fa);
+    if (in_fd != -1 && in_fd != STDIN_FILENO)
+        posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO);
+    if (out_fd != -1 && out_fd != STDOUT_FILENO)
+        posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO);
+
+    // The shell may block signals (evloop.h), commands start with none blocked
+    posix_spawnattr_t attr;
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    int err = ENOENT;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        const char *path = path_hash_lookup(spec->argv[0]);
+        if (path == NULL)
+            break;
+        uint64_t t0 = stats_now_ns();
+        if (spec->pre_exec)
+            err = launch_fork(&pid, path, spec, in_fd, out_fd);
+        else
+            err = posix_spawn(&pid, path, &fa, &attr, spec->argv, spec->envp ? spec->envp : environ);
+        if (err == 0) stats_record(STAT_SPAWN, stats_now_ns() - t0);
+        if (err != ENOENT || path == spec->argv[0])
+            break;
+        path_hash_forget(spec->argv[0]);  // cached binary is gone, resolve again
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (opened_in != -1) close(opened_in);
+    if (opened_out != -1) close(opened_out);
+
+    if (err != 0) {
+        errno = err;
+        fprintf(stderr, "%s: %s\n", spec->argv[0], err == ENOENT ? "command not found" : strerror(err));
+        return -1;
+    }
+    return pid;
+}
+
+// Convenience wrapper for the common case of a command with no redirections
+static inline pid_t launch_argv(char **argv) {
+    struct launch_spec spec;
+    launch_spec_init(&spec, argv);
+    return launch_command(&spec);
+}
+
+#endif
@@ -0,0 +1,312 @@
+/*
+*  lexer.h: one quoting aware lexer shared by every shell version
+*  lex_line() splits a line in a single pass into words and the operators
+*  | < > &. Words are spans of the line itself: quotes and backslashes are
+*  removed by moving the bytes down in place (the result is never longer
+*  than the source) and each word is NUL terminated where it ends, so no
+*  token is ever copied or allocated.
+*     'text'   literal, nothing inside is special
+*     "text"   \" \\ \$ are escapes, $NAME still expands
+*     \c       c taken literally outside quotes
+*  Blanks are spaces, tabs, CR and LF. An operator needs no blanks around
+*  it ("ls|wc" is three tokens).
+*  Every $NAME or ${NAME} that is neither quoted with ' nor escaped is
+*  recorded in list->dollars with where it ends up in the unquoted word, so
+*  expansion (expand.h) never has to guess which $ in the text was literal.
+*  Between special bytes the lexer skips ordinary text 16 or 32 bytes at a
+*  time with SSE2 or AVX2 compares (AVX2 is picked at run time), or one table
+*  lookup per byte elsewhere, so multi megabyte script lines stay cheap.
+*/
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+enum token_type { TOK_WORD, TOK_PIPE, TOK_IN, TOK_OUT, TOK_BG };
+
+#define TOKEN_QUOTED 1  // had quotes or backslashes, text is the unescaped form
+#define TOKEN_DOLLAR 2  // has a variable to expand, see list->dollars and expand.h
+
+struct token {
+    char *text;         // NUL terminated, inside the line (operators: a static string)
+    uint32_t len;
+    uint8_t type;       // enum token_type
+    uint8_t flags;
+};
+
+// An expandable "$NAME" or "${NAME}" as written, inside a word's text
+struct lex_dollar {
+    char *at;
+    uint32_t len;
+};
+
+struct token_list {
+    struct token *tokens;
+    size_t count, cap;
+    struct lex_dollar *dollars;     // in line order
+    size_t dollar_count, dollar_cap;
+};
+
+// Byte classes. Every byte with a class stops the fast scan, LEX_CTRL bytes
+// (other control characters) are stopped on by the SIMD test but are plain
+// text to the lexer
+#define LEX_CTRL   1
+#define LEX_BLANK  2
+#define LEX_OP     4
+#define LEX_QUOTE  8
+#define LEX_DOLLAR 16
+#define LEX_END    32
+
+static const uint8_t lex_class[256] = {
+    [0] = LEX_END,
+    [1 ... 8] = LEX_CTRL, ['\t'] = LEX_BLANK, ['\n'] = LEX_BLANK,
+    [0x0b ... 0x0c] = LEX_CTRL, ['\r'] = LEX_BLANK, [0x0e ... 0x1f] = LEX_CTRL,
+    [' '] = LEX_BLANK,
+    ['|'] = LEX_OP, ['<'] = LEX_OP, ['>'] = LEX_OP, ['&'] = LEX_OP,
+    ['\''] = LEX_QUOTE, ['"'] = LEX_QUOTE, ['\\'] = LEX_QUOTE,
+    ['$'] = LEX_DOLLAR,
+};
+
+static inline const char *lex_scan_scalar(const char *p) {
+    while (lex_class[(unsigned char)*p] == 0) p++;
+    return p;
+}
+
+#if defined(__SSE2__)
+// Aligned loads never cross into the next page, so reading past the NUL is
+// safe; bytes before p are masked off the first block
+static inline const char *lex_scan_sse2(const char *p) {
+    const __m128i space = _mm_set1_epi8(0x20);
+    const char *block = (const char *)((uintptr_t)p & ~(uintptr_t)15);
+    unsigned skip = p - block;
+    for (;;) {
+        __m128i x = _mm_load_si128((const __m128i *)block);
+        __m128i hit = _mm_cmpeq_epi8(_mm_max_epu8(x, space), space);   // x <= 0x20
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, _mm_set1_epi8('$')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, _mm_set1_epi8('&')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, _mm_set1_epi8('\'')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, _mm_set1_epi8('<')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, _mm_set1_epi8('>')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, _mm_set1_epi8('|')));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit) >> skip << skip;
+        if (mask) return block + __builtin_ctz(mask);
+        block += 16;
+        skip = 0;
+    }
+}
+
+__attribute__((target("avx2")))
+static inline const char *lex_scan_avx2(const char *p) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const char *block = (const char *)((uintptr_t)p & ~(uintptr_t)31);
+    unsigned skip = p - block;
+    for (;;) {
+        __m256i x = _mm256_load_si256((const __m256i *)block);
+        __m256i hit = _mm256_cmpeq_epi8(_mm256_max_epu8(x, space), space);
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('$')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('&')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\'')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('<')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('>')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('|')));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+        mask = skip ? mask >> skip << skip : mask;
+        if (mask) return block + __builtin_ctz(mask);
+        block += 32;
+        skip = 0;
+    }
+}
+#endif
+
+// First byte at or after p that has a class (the NUL always has one)
+static inline const char *lex_scan(const char *p) {
+#if defined(__SSE2__)
+    static const char *(*scan)(const char *);
+    if (scan == NULL)
+        scan = __builtin_cpu_supports("avx2") ? lex_scan_avx2 : lex_scan_sse2;
+    return scan(p);
+#else
+    return lex_scan_scalar(p);
+#endif
+}
+
+static inline void token_list_free(struct token_list *list) {
+    free(list->tokens);
+    free(list->dollars);
+    list->tokens = NULL;
+    list->dollars = NULL;
+    list->count = list->cap = 0;
+    list->dollar_count = list->dollar_cap = 0;
+}
+
+static inline struct token *lex_push(struct token_list *list, uint8_t type, char *text, size_t len) {
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 16;
+        list->tokens = realloc(list->tokens, list->cap * sizeof(*list->tokens));
+    }
+    struct token *t = &list->tokens[list->count++];
+    t->text = text;
+    t->len = len;
+    t->type = type;
+    t->flags = 0;
+    return t;
+}
+
+static inline void lex_push_dollar(struct token_list *list, char *at, size_t len) {
+    if (list->dollar_count == list->dollar_cap) {
+        list->dollar_cap = list->dollar_cap ? list->dollar_cap * 2 : 8;
+        list->dollars = realloc(list->dollars, list->dollar_cap * sizeof(*list->dollars));
+    }
+    list->dollars[list->dollar_count++] = (struct lex_dollar){ at, len };
+}
+
+// Length of the variable reference at p ("$NAME" or "${NAME}", NAME made of
+// letters, digits and _), 0 when the $ is plain text
+static inline size_t lex_var_len(const char *p) {
+    const char *name = p + 1 + (p[1] == '{'), *q = name;
+    while (isalnum((unsigned char)*q) || *q == '_') q++;
+    if (q == name) return 0;
+    if (p[1] == '{') return *q == '}' ? (size_t)(q + 1 - p) : 0;
+    return q - p;
+}
+
+static inline void lex_push_op(struct token_list *list, char c) {
+    switch (c) {
+    case '|': lex_push(list, TOK_PIPE, "|", 1); break;
+    case '<': lex_push(list, TOK_IN, "<", 1); break;
+    case '>': lex_push(list, TOK_OUT, ">", 1); break;
+    default:  lex_push(list, TOK_BG, "&", 1); break;
+    }
+}
+
+// Tokenizes line (NUL terminated) in place into list, which is emptied first
+// and keeps its memory between calls. Returns the number of tokens or -1
+// for an unterminated quote.
+static inline int lex_line(char *line, struct token_list *list) {
+    char *p = line;
+    list->count = 0;
+    list->dollar_count = 0;
+    for (;;) {
+        while (lex_class[(unsigned char)*p] & LEX_BLANK) p++;
+        if (*p == '\0') break;
+        if (lex_class[(unsigned char)*p] & LEX_OP) {
+            lex_push_op(list, *p++);
+            continue;
+        }
+
+        // A word: plain runs are skipped, quoting switches to copying down
+        // through w, which then trails p
+        char *start = p, *w = NULL;
+        uint8_t flags = 0;
+        char c;
+        for (;;) {
+            char *q = (char *)lex_scan(p);
+            if (w) {
+                memmove(w, p, q - p);
+                w += q - p;
+            }
+            p = q;
+            c = *p;
+            uint8_t cls = lex_class[(unsigned char)c];
+            if (cls & (LEX_BLANK | LEX_OP | LEX_END)) break;
+            if (cls == LEX_CTRL || cls == LEX_DOLLAR) {
+                size_t n = cls == LEX_DOLLAR ? lex_var_len(p) : 0;
+                if (n) {
+                    flags |= TOKEN_DOLLAR;
+                    lex_push_dollar(list, w ? w : p, n);
+                } else {
+                    n = 1;
+                }
+                if (w) {
+                    memmove(w, p, n);
+                    w += n;
+                }
+                p += n;
+                continue;
+            }
+            // Quote or backslash
+            if (w == NULL) w = p;
+            flags |= TOKEN_QUOTED;
+            if (c == '\\') {
+                if (p[1] == '\0') {         // trailing backslash stays
+                    *w++ = *p++;
+                } else {
+                    *w++ = p[1];
+                    p += 2;
+                }
+            } else if (c == '\'') {
+                char *end = strchr(p + 1, '\'');
+                if (end == NULL) {
+                    fprintf(stderr, "syntax error: unterminated quote\n");
+                    return -1;
+                }
+                memmove(w, p + 1, end - p - 1);
+                w += end - p - 1;
+                p = end + 1;
+            } else {
+                p++;
+                for (;;) {
+                    char *end = p + strcspn(p, "\"\\$");
+                    memmove(w, p, end - p);
+                    w += end - p;
+                    p = end;
+                    if (*p == '\0') {
+                        fprintf(stderr, "syntax error: unterminated quote\n");
+                        return -1;
+                    }
+                    if (*p == '"') {
+                        p++;
+                        break;
+                    }
+                    if (*p == '$') {
+                        size_t n = lex_var_len(p);
+                        if (n) {
+                            flags |= TOKEN_DOLLAR;
+                            lex_push_dollar(list, w, n);
+                        } else {
+                            n = 1;
+                        }
+                        memmove(w, p, n);
+                        w += n;
+                        p += n;
+                    } else if (p[1] == '"' || p[1] == '\\' || p[1] == '$') {
+                        *w++ = p[1];
+                        p += 2;
+                    } else {
+                        *w++ = *p++;    // any other backslash is kept
+                    }
+                }
+            }
+        }
+        char *end = w ? w : p;
+        lex_push(list, TOK_WORD, start, end - start)->flags = flags;
+        *end = '\0';    // may overwrite c when nothing was unescaped, c was read first
+        if (c == '\0') break;
+        if (lex_class[(unsigned char)c] & LEX_OP) lex_push_op(list, c);
+        p++;
+    }
+    return list->count;
+}
+
+// Copies the token texts (operators as "|", "<", ">", "&") to argv, at most
+// max - 1 of them, and NULL terminates it. Returns the number copied
+static inline int lex_argv(const struct token_list *list, char **argv, int max) {
+    int n = 0;
+    for (size_t i = 0; i < list->count && n < max - 1; i++)
+        argv[n++] = list->tokens[i].text;
+    argv[n] = NULL;
+    return n;
+}
+
+#endif
@@ -0,0 +1,383 @@
+/*
+*  memo.h: "cache <cmd...>" output memoization for deterministic commands
+*  A cached command line is keyed by a 128 bit hash of everything its output
+*  may depend on: every stage's argv, the resolved binary of each stage (path,
+*  size, mtime), the working directory, the environment and the "<" input file
+*  (its contents up to MEMO_HASH_MAX bytes, its size and mtime beyond). The
+*  entry file named after the key holds the stdout of the last stage followed
+*  by a trailer with the wait status and the original run time. A hit writes
+*  the stored output with sendfile() and runs nothing at all; a miss runs the
+*  pipeline with its stdout going to a temporary file in the cache directory,
+*  copies that out and renames it into place.
+*     $CACHEDIR    cache directory, default ~/.pucit_cache
+*     $CACHESIZE   size bound in MiB, default 256
+*  Entries are evicted least recently used first (a hit touches the file's
+*  mtime) down to 3/4 of the bound once a store goes over it. Only stdout is
+*  replayed: stderr and files written with ">" by earlier stages are not.
+*  A cached command reads /dev/null when it has no "<" file, since what the
+*  shell's stdin would have given it cannot be part of the key. Output
+*  appears once the command has finished. Commands killed by a signal or
+*  that failed to start are not stored.
+*  Needs _GNU_SOURCE (pipe2, F_SETPIPE_SZ for pipeline.h) defined before the
+*  first include.
+*/
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "pipeline.h"
+
+#define MEMO_DIR_NAME ".pucit_cache"
+#define MEMO_DEFAULT_MIB 256
+#define MEMO_HASH_MAX (64 << 20)    // input files larger than this are keyed by size and mtime
+#define MEMO_KEY_LEN 32             // hex digits of the key
+
+struct memo_hash {
+    uint64_t a, b, len;
+};
+
+struct memo_trailer {
+    char magic[8];
+    int32_t status;     // wait status of the last stage
+    uint32_t reserved;
+    uint64_t length;    // bytes of output before the trailer
+    uint64_t run_ns;    // how long the command took when it was stored
+};
+
+static const char memo_magic[8] = "PUCMEMO1";
+
+struct memo {
+    char *dir;
+    uint64_t max_bytes;
+    uint64_t total;     // bytes in the directory, counted on first use
+    long entries;
+    int ready;          // memo_init() done, dir is usable when it is set
+    uint64_t hits, misses, stores, evictions, uncacheable;
+    uint64_t replayed;  // output bytes written from the cache
+    uint64_t saved_ns;  // run time of the commands that were replayed
+};
+
+static struct memo memo;
+
+static inline uint64_t memo_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+}
+
+// Two independent lanes over 8 byte words, finished with memo_mix()
+static inline void memo_hash_update(struct memo_hash *h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    h->len += len;
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h->a = (h->a ^ w) * 0x9e3779b97f4a7c15ULL;
+        h->a ^= h->a >> 29;
+        h->b = (h->b + w) * 0xff51afd7ed558ccdULL;
+        h->b = h->b << 31 | h->b >> 33;
+        p += 8;
+        len -= 8;
+    }
+    if (len) {
+        uint64_t w = 0;
+        memcpy(&w, p, len);
+        h->a = (h->a ^ w ^ len << 56) * 0x9e3779b97f4a7c15ULL;
+        h->b = (h->b + w) * 0xff51afd7ed558ccdULL;
+    }
+}
+
+// Strings go in with their length, so "ab","c" and "a","bc" differ
+static inline void memo_hash_str(struct memo_hash *h, const char *s) {
+    uint64_t len = strlen(s);
+    memo_hash_update(h, &len, sizeof(len));
+    memo_hash_update(h, s, len);
+}
+
+static inline void memo_hash_stat(struct memo_hash *h, const struct stat *sb) {
+    uint64_t fields[5] = { sb->st_dev, sb->st_ino, sb->st_size,
+                           sb->st_mtim.tv_sec, sb->st_mtim.tv_nsec };
+    memo_hash_update(h, fields, sizeof(fields));
+}
+
+static inline void memo_hash_hex(const struct memo_hash *h, char *out) {
+    uint64_t a = memo_mix(h->a ^ h->len), b = memo_mix(h->b ^ memo_mix(h->len + h->a));
+    snprintf(out, MEMO_KEY_LEN + 1, "%016llx%016llx", (unsigned long long)a, (unsigned long long)b);
+}
+
+// Reads CACHEDIR and CACHESIZE, counts what is already in the directory
+static inline void memo_init(void) {
+    if (memo.ready) return;
+    memo.ready = 1;
+    const char *size = getenv("CACHESIZE");
+    memo.max_bytes = (uint64_t)(size && atol(size) > 0 ? atol(size) : MEMO_DEFAULT_MIB) << 20;
+    const char *dir = getenv("CACHEDIR");
+    const char *home = getenv("HOME");
+    if (dir && *dir) {
+        memo.dir = strdup(dir);
+    } else if (home) {
+        memo.dir = malloc(strlen(home) + sizeof(MEMO_DIR_NAME) + 1);
+        sprintf(memo.dir, "%s/%s", home, MEMO_DIR_NAME);
+    } else {
+        return;
+    }
+    if (mkdir(memo.dir, 0700) == -1 && errno != EEXIST) {
+        perror("cache directory");
+        free(memo.dir);
+        memo.dir = NULL;
+        return;
+    }
+    DIR *d = opendir(memo.dir);
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) {
+        struct stat sb;
+        if (strlen(e->d_name) != MEMO_KEY_LEN) continue;
+        if (fstatat(dirfd(d), e->d_name, &sb, 0) == 0) {
+            memo.total += sb.st_size;
+            memo.entries++;
+        }
+    }
+    if (d) closedir(d);
+}
+
+struct memo_victim {
+    char name[MEMO_KEY_LEN + 1];
+    struct timespec used;
+    off_t size;
+};
+
+static int memo_cmp_used(const void *x, const void *y) {
+    const struct memo_victim *a = x, *b = y;
+    if (a->used.tv_sec != b->used.tv_sec) return a->used.tv_sec < b->used.tv_sec ? -1 : 1;
+    return (a->used.tv_nsec > b->used.tv_nsec) - (a->used.tv_nsec < b->used.tv_nsec);
+}
+
+// Removes the least recently used entries until the cache is at 3/4 of its
+// bound. The directory is rescanned, so other shells' entries count too
+static inline void memo_evict(void) {
+    DIR *d = opendir(memo.dir);
+    if (d == NULL) return;
+    struct memo_victim *v = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t total = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        struct stat sb;
+        if (strlen(e->d_name) != MEMO_KEY_LEN || fstatat(dirfd(d), e->d_name, &sb, 0) == -1) continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            v = realloc(v, cap * sizeof(*v));
+        }
+        memcpy(v[count].name, e->d_name, MEMO_KEY_LEN + 1);
+        v[count].used = sb.st_mtim;
+        v[count].size = sb.st_size;
+        total += sb.st_size;
+        count++;
+    }
+    qsort(v, count, sizeof(*v), memo_cmp_used);
+    uint64_t target = memo.max_bytes / 4 * 3;
+    size_t i = 0;
+    for (; i < count && total > target; i++) {
+        if (unlinkat(dirfd(d), v[i].name, 0) == 0) {
+            total -= v[i].size;
+            memo.evictions++;
+        }
+    }
+    memo.total = total;
+    memo.entries = count - i;
+    closedir(d);
+    free(v);
+}
+
+// Computes the key of pl into hex. Returns -1 when the line cannot be
+// cached (a command that is not found, an input that is not a regular file)
+static inline int memo_key(const struct pipeline *pl, char *hex) {
+    struct memo_hash h = { 0x243f6a8885a308d3ULL, 0x13198a2e03707344ULL, 0 };
+    char cwd[4096];
+    memo_hash_str(&h, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+    for (char **env = environ; *env; env++) memo_hash_str(&h, *env);
+    for (int i = 0; i < pl->count; i++) {
+        const struct stage *st = &pl->stages[i];
+        struct stat sb;
+        const char *path = path_hash_lookup(st->argv[0]);
+        if (path == NULL || stat(path, &sb) == -1) return -1;
+        memo_hash_str(&h, path);
+        memo_hash_stat(&h, &sb);
+        for (int k = 0; k < st->argc; k++) memo_hash_str(&h, st->argv[k]);
+        memo_hash_str(&h, "|");
+        if (st->input_file == NULL) continue;
+        int fd = open(st->input_file, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return -1;
+        if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+            close(fd);
+            return -1;
+        }
+        memo_hash_str(&h, st->input_file);
+        if (sb.st_size > MEMO_HASH_MAX) {
+            memo_hash_stat(&h, &sb);
+        } else if (sb.st_size > 0) {
+            void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                close(fd);
+                return -1;
+            }
+            memo_hash_update(&h, map, sb.st_size);
+            munmap(map, sb.st_size);
+        }
+        close(fd);
+    }
+    memo_hash_hex(&h, hex);
+    return 0;
+}
+
+// Copies len bytes from the start of in to out, sendfile() where it can
+static inline int memo_copy(int in, int out, uint64_t len) {
+    off_t off = 0;
+    while ((uint64_t)off < len) {
+        ssize_t n = sendfile(out, in, &off, len - off);
+        if (n > 0 || (n == -1 && errno == EINTR)) continue;
+        if (n == 0) return 0;   // the file is shorter than it was
+        if (errno != EINVAL && errno != ENOSYS) return -1;
+        // out does not take sendfile(), e.g. opened with O_APPEND
+        char buf[65536];
+        while ((uint64_t)off < len) {
+            ssize_t r = pread(in, buf, len - off < sizeof(buf) ? len - off : sizeof(buf), off);
+            if (r <= 0) return r;
+            for (ssize_t w = 0; w < r;) {
+                ssize_t m = write(out, buf + w, r - w);
+                if (m == -1 && errno == EINTR) continue;
+                if (m == -1) return -1;
+                w += m;
+            }
+            off += r;
+        }
+    }
+    return 0;
+}
+
+// The descriptor the command's stdout goes to, -1 with the error printed
+static inline int memo_output(const char *output_file) {
+    if (output_file == NULL) return STDOUT_FILENO;
+    int fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) perror("Error opening output file");
+    return fd;
+}
+
+// Replays entry fd if it is complete, returns its wait status or -1
+static inline int memo_replay(int fd, const char *output_file) {
+    struct stat sb;
+    struct memo_trailer t;
+    if (fstat(fd, &sb) == -1 || sb.st_size < (off_t)sizeof(t) ||
+        pread(fd, &t, sizeof(t), sb.st_size - sizeof(t)) != sizeof(t) ||
+        memcmp(t.magic, memo_magic, sizeof(t.magic)) != 0 || t.length != sb.st_size - sizeof(t))
+        return -1;
+    int out = memo_output(output_file);
+    if (out == -1) return 1 << 8;
+    fflush(stdout);
+    if (memo_copy(fd, out, t.length) == -1) perror("cache");
+    if (out != STDOUT_FILENO) close(out);
+    futimens(fd, NULL);     // most recently used now
+    memo.hits++;
+    memo.replayed += t.length;
+    memo.saved_ns += t.run_ns;
+    return t.status;
+}
+
+// Runs pl once with its output captured, then renames that into entry
+static inline int memo_store(struct pipeline *pl, const char *entry) {
+    struct stage *last = &pl->stages[pl->count - 1];
+    char *output_file = last->output_file;
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s/tmp.XXXXXX", memo.dir);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd == -1) {
+        perror("cache");
+        if (start_pipeline(pl) > 0) return wait_pipeline(pl, NULL);
+        return 127 << 8;
+    }
+
+    last->output_file = tmp;
+    uint64_t t0 = stats_now_ns();
+    int started = start_pipeline(pl) == pl->count;
+    int status = wait_pipeline(pl, NULL);
+    uint64_t run_ns = stats_now_ns() - t0;
+    last->output_file = output_file;
+
+    struct stat sb;
+    int out = memo_output(output_file);
+    int ok = fstat(fd, &sb) == 0 && out != -1;
+    if (ok) {
+        fflush(stdout);
+        if (memo_copy(fd, out, sb.st_size) == -1) perror("cache");
+    }
+    if (out > STDOUT_FILENO) close(out);
+
+    struct memo_trailer t = { .status = status, .length = ok ? sb.st_size : 0, .run_ns = run_ns };
+    memcpy(t.magic, memo_magic, sizeof(t.magic));
+    if (ok && started && !WIFSIGNALED(status) &&
+        pwrite(fd, &t, sizeof(t), sb.st_size) == sizeof(t) && rename(tmp, entry) == 0) {
+        memo.stores++;
+        memo.entries++;
+        memo.total += sb.st_size + sizeof(t);
+        if (memo.total > memo.max_bytes) memo_evict();
+    } else {
+        unlink(tmp);
+    }
+    close(fd);
+    return status;
+}
+
+// Runs pl through the cache, returns the wait status of its last stage
+static inline int memo_run(struct pipeline *pl) {
+    memo_init();
+    char hex[MEMO_KEY_LEN + 1];
+    if (memo.dir == NULL || memo_key(pl, hex) == -1) {
+        // Not cacheable, run it as it is (which reports what is wrong with it)
+        memo.uncacheable++;
+        return start_pipeline(pl) > 0 ? wait_pipeline(pl, NULL) : 127 << 8;
+    }
+
+    char entry[4096];
+    snprintf(entry, sizeof(entry), "%s/%s", memo.dir, hex);
+    int fd = open(entry, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        int status = memo_replay(fd, pl->stages[pl->count - 1].output_file);
+        close(fd);
+        if (status != -1) return status;
+    }
+    memo.misses++;
+    struct stage *first = &pl->stages[0];
+    char devnull[] = "/dev/null";
+    if (first->input_file == NULL) first->input_file = devnull;
+    int status = memo_store(pl, entry);
+    if (first->input_file == devnull) first->input_file = NULL;
+    return status;
+}
+
+// Hit rate and sizes, for "cache" without a command
+static inline void memo_print_stats(void) {
+    memo_init();
+    uint64_t lookups = memo.hits + memo.misses;
+    printf("cache: %llu hits, %llu misses (%.1f%% hit rate), %llu stored, %llu evicted, %llu not cacheable\n",
+           (unsigned long long)memo.hits, (unsigned long long)memo.misses,
+           lookups ? 100.0 * memo.hits / lookups : 0.0, (unsigned long long)memo.stores,
+           (unsigned long long)memo.evictions, (unsigned long long)memo.uncacheable);
+    printf("cache: %.1f KiB replayed, %.3fs of run time saved\n",
+           memo.replayed / 1024.0, memo.saved_ns / 1e9);
+    printf("cache: %ld entries, %.1f of %.1f MiB in %s\n", memo.entries, memo.total / 1048576.0,
+           memo.max_bytes / 1048576.0, memo.dir ? memo.dir : "(none)");
+}
+
+#endif
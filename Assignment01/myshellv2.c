@@ -1,153 +1,134 @@
+#define _GNU_SOURCE  // pipe2(), F_SETPIPE_SZ
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include "pipeline.h"
+#include "memo.h"
+#include "scriptc.h"
+#include "input.h"
 
-#define MAX_CMD_LEN 1024
-#define MAX_ARGS 64
-
-// Function to parse the command and separate arguments, file redirection, and pipe handling
-void parse_command(char *cmd, char **args, int *input_redirect, char **input_file, int *output_redirect, char **output_file, int *pipe_flag, char **cmd_after_pipe) {
-    // Initialize flags for input/output redirection and piping
-    *input_redirect = *output_redirect = *pipe_flag = 0;
-    *input_file = *output_file = NULL;
-    *cmd_after_pipe = NULL;
-
-    int i = 0;  // Index for storing arguments
-    char *token = strtok(cmd, " \n");  // Split the command by spaces and newlines (buiitin)
+// Function to parse the command into pipeline stages, each with its own arguments and
+// "<" / ">" redirections (see pipeline.h). Returns -1 on a syntax error
+int parse_command(char *cmd, struct pipeline *pl) {
+    return parse_pipeline(cmd, pl);
+}
 
-    // Loop through each part of the command
-    while (token != NULL) {
-        if (strcmp(token, "<") == 0) {  // Check if input redirection is needed (String comparison builtin)
-            *input_redirect = 1;
-            token = strtok(NULL, " \n");  // Get the input file name
-            *input_file = token;
-        } else if (strcmp(token, ">") == 0) {  // Check if output redirection is needed
-            *output_redirect = 1;
-            token = strtok(NULL, " \n");  // Get the output file name
-            *output_file = token;
-        } else if (strcmp(token, "|") == 0) {  // Check if there's a pipe in the command
-            *pipe_flag = 1;
-            args[i] = NULL;  // Null-terminate the first command
-            token = strtok(NULL, " \n");  // Move to the command after the pipe
-            *cmd_after_pipe = token;
-            break;  // Stop parsing for the first command
+// Function to execute the parsed pipeline: every pipe is created and every stage is
+// started before the shell waits, then all of them are reaped in one wait loop.
+// "cache cmd ..." runs the pipeline through the output cache (see memo.h),
+// "cache" alone prints its statistics. The first "cat" that only copies files
+// or a pipe is done by the shell itself without a process (see pipeline.h);
+// one at most, while the shell copies it reads or writes for no other stage
+void execute_command(struct pipeline *pl) {
+    struct stage *first = &pl->stages[0];
+    if (strcmp(first->argv[0], "cache") == 0) {
+        if (first->argc > 1) {
+            memmove(first->argv, first->argv + 1, first->argc-- * sizeof(char *));
+            memo_run(pl);
+        } else if (pl->count == 1) {
+            memo_print_stats();
         } else {
-            args[i++] = token;  // Store each argument in the args array
+            fprintf(stderr, "cache: missing command\n");
         }
-        token = strtok(NULL, " \n");  // Move to the next part
+        return;
+    }
+    struct stage *copy = NULL;
+    for (int i = 0; i < pl->count && copy == NULL; i++) {
+        if (stage_is_copy(pl, i)) copy = &pl->stages[i];
+    }
+    if (copy) copy->in_shell = 1;
+    int started = start_pipeline(pl);
+    if (copy) {
+        // Its pipe ends are missing only if start_pipeline() could not make them
+        int first = copy == &pl->stages[0], last = copy == &pl->stages[pl->count - 1];
+        if ((first || copy->in_fd != -1) && (last || copy->out_fd != -1))
+            copy->status = run_copy_stage(copy);
+        stage_close_fds(copy);
+    }
+    if (started > 0) {
+        wait_pipeline(pl, NULL);
     }
-    args[i] = NULL;  // Null-terminate the args array
 }
 
-// Function to execute the command with support for input/output redirection and piping
-void execute_command(char **args, int input_redirect, char *input_file, int output_redirect, char *output_file, int pipe_flag, char *cmd_after_pipe) {
-    int pid1, pid2, status;
-
-    if (pipe_flag) {
-        // If there's a pipe, create a pipe file descriptor array
-        int pipe_fd[2];
-        if (pipe(pipe_fd) == -1) {
-            perror("pipe failed");
-            exit(1);
-        }
-
-        // First command (before the "|")
-        pid1 = fork();
-        if (pid1 == 0) {
-            // Redirect the standard output to the write end of the pipe
-            dup2(pipe_fd[1], STDOUT_FILENO);
-            close(pipe_fd[0]);  // Close unused read end
-            close(pipe_fd[1]);  // Close write end after redirecting
-            execvp(args[0], args);  // Execute the first command
-            perror("execvp failed");  // Error if execvp fails
-            exit(1);
-        }
-
-        // Second command (after the "|")
-        pid2 = fork();
-        if (pid2 == 0) {
-            // Redirect the standard input to the read end of the pipe
-            dup2(pipe_fd[0], STDIN_FILENO);
-            close(pipe_fd[1]);  // Close unused write end
-            close(pipe_fd[0]);  // Close read end after redirecting
+// Prints how to start the shell
+void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-p pipe_buffer_bytes] [-C] [-c commands | script]\n", prog);
+}
 
-            // Parse the command after pipe into arguments for the second command
-            char *args_after_pipe[MAX_ARGS];
-            args_after_pipe[0] = cmd_after_pipe;
-            int j = 1;
-            char *token = strtok(NULL, " \n");
-            while (token != NULL) {
-                args_after_pipe[j++] = token;
-                token = strtok(NULL, " \n");
-            }
-            args_after_pipe[j] = NULL;  // Null-terminate the second command
+int main(int argc, char *argv[]) {
+    char *cmd;
+    struct pipeline pl;
+    struct line_reader reader;
+    char *commands = NULL;
+    int opt, compile = 0;
 
-            execvp(args_after_pipe[0], args_after_pipe);  // Execute the second command
-            perror("execvp failed");  // Error if execvp fails
-            exit(1);
+    pipeline_init(&pl);
+    // -p resizes every pipe buffer (F_SETPIPE_SZ) for high throughput pipelines
+    // -c runs the given commands, a remaining operand is a script file (see input.h)
+    // -C runs a script file from its compiled form, made on its first run
+    while ((opt = getopt(argc, argv, "+p:c:C")) != -1) {
+        if (opt == 'p') {
+            pl.pipe_size = atoi(optarg);
+        } else if (opt == 'C') {
+            compile = 1;
+        } else if (opt == 'c') {
+            commands = optarg;
+        } else {
+            usage(argv[0]);
+            return 1;
         }
+    }
+    if (commands) {
+        if (reader_init_string(&reader, commands) == -1) return 1;
+    } else if (reader_from_args(&reader, argc, argv, optind) == -1) {
+        return 1;
+    }
 
-        // Close the pipe in the parent process
-        close(pipe_fd[0]);
-        close(pipe_fd[1]);
-        // Wait for both child processes to finish
-        waitpid(pid1, &status, 0);
-        waitpid(pid2, &status, 0);
-    } else {
-        // If there's no pipe, execute a single command
-        pid1 = fork();
-        if (pid1 == 0) {
-            // Handle input redirection if specified
-            if (input_redirect) {
-                int in_fd = open(input_file, O_RDONLY);
-                if (in_fd == -1) {
-                    perror("Error opening input file");
-                    exit(1);
-                }
-                dup2(in_fd, STDIN_FILENO);  // Redirect standard input
-                close(in_fd);  // Close input file descriptor after redirecting
-            }
-            // Handle output redirection if specified
-            if (output_redirect) {
-                int out_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                if (out_fd == -1) {
-                    perror("Error opening output file");
-                    exit(1);
-                }
-                dup2(out_fd, STDOUT_FILENO);  // Redirect standard output
-                close(out_fd);  // Close output file descriptor after redirecting
+    // With -C a script that ran before is executed from its compiled form,
+    // with no parsing at all; the first run records it (see scriptc.h)
+    struct script script;
+    int compiled = !commands && optind < argc && compile ? script_open(&script, argv[optind]) : -1;
+    if (compiled == 1) {
+        struct pipeline direct;
+        pipeline_init(&direct);
+        direct.pipe_size = pl.pipe_size;
+        for (uint32_t i = 0; i < script.header->lines; i++) {
+            const char *raw = script_pipeline(&script, i, &direct);
+            if (raw == NULL) {
+                execute_command(&direct);
+            } else {
+                // Did not parse last time either, parse_command() reports it
+                char *line = strdup(raw);
+                if (parse_command(line, &pl) == 0 && pl.count > 0) execute_command(&pl);
+                free(line);
             }
-            execvp(args[0], args);  // Execute the command
-            perror("execvp failed");  // Error if execvp fails
-            exit(1);
         }
-        waitpid(pid1, &status, 0);  // Wait for the command to finish
+        script_pipeline_free(&direct);
     }
-}
-
-int main() {
-    char cmd[MAX_CMD_LEN];
-    char *args[MAX_ARGS];
-    int input_redirect, output_redirect, pipe_flag;
-    char *input_file, *output_file, *cmd_after_pipe;
 
     // Main loop to read and execute commands until exit
-    while (1) {
-        printf("PUCITshell:- ");  // Display prompt
-        if (fgets(cmd, MAX_CMD_LEN, stdin) == NULL) {  // Read command from user
-            printf("\n");
-            break;  // Exit on CTRL+D
+    while (compiled != 1) {
+        // Prompt only on a terminal, input is read in large blocks (see input.h)
+        if ((cmd = read_line(&reader, "PUCITshell:- ")) == NULL) {
+            if (reader.interactive) printf("\n");
+            break;  // Exit on CTRL+D or end of script
         }
 
-        // Parse the command into arguments and other flags
-        parse_command(cmd, args, &input_redirect, &input_file, &output_redirect, &output_file, &pipe_flag, &cmd_after_pipe);
-        if (args[0] != NULL) {
-            execute_command(args, input_redirect, input_file, output_redirect, output_file, pipe_flag, cmd_after_pipe);  // Run the parsed command
+        // Parse the command into pipeline stages and run it
+        if (compiled == 0) script_begin_line(&script, cmd);
+        int parsed = parse_command(cmd, &pl) == 0;
+        if (compiled == 0) script_end_line(&script, parsed ? &pl : NULL);
+        if (parsed && pl.count > 0) {
+            execute_command(&pl);
         }
     }
+    if (compiled == 0 && reader.eof) script_save(&script);  // only a script read to the end
+    if (compiled != -1) script_close(&script);
+    pipeline_free(&pl);
+    reader_close(&reader);
 
     return 0;
 }
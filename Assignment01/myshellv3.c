@@ -4,19 +4,30 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <errno.h>
 #include <signal.h>
+#include "launcher.h"
+#include "input.h"
+#include "lexer.h"
 
 #define MAX_LINE 1024
 #define MAX_ARGS 100
 
 void sigchld_handler(int signo) {
-    // Reap child processes to prevent zombies
-    while (waitpid(-1, NULL, WNOHANG) > 0);
+    // Reap finished children without waiting, wait4() also hands back their
+    // resource usage (see stats.h)
+    int saved = errno, status;
+    struct rusage ru;
+    while (wait4(-1, &status, WNOHANG, &ru) > 0) stats_usage(&ru);
+    errno = saved;
 }
 
-int main() {
-    char input[MAX_LINE];
+int main(int argc, char *argv[]) {
+    char *input;                // Current line, owned by the reader
+    struct line_reader reader;  // Buffered terminal/script input (see input.h)
     char *args[MAX_ARGS];
+    struct token_list tokens = { 0 }; // Reused for every line (see lexer.h)
     struct sigaction sa;
 
     // Set up signal handling for SIGCHLD
@@ -25,57 +36,57 @@ int main() {
     sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
     sigaction(SIGCHLD, &sa, NULL);
 
+    // Commands come from -c, a script file or stdin, prompts only on a terminal
+    if (reader_from_args(&reader, argc, argv, 1) == -1) {
+        return 1;
+    }
+
     int job_number = 0; // To keep track of background jobs
 
     while (1) {
-        // Prompt the user
-        printf("PUCITshell:- ");
-
-        // Read user input
-        if (fgets(input, MAX_LINE, stdin) == NULL) {
+        // Prompt the user (terminal only) and read the next command
+        if ((input = read_line(&reader, "PUCITshell:- ")) == NULL) {
             break; // Exit on Ctrl+D
         }
 
-        // Remove trailing newline
-        input[strcspn(input, "\n")] = 0;
+        // Split the input into words and operators, quotes and escapes are handled (see lexer.h)
+        if (lex_line(input, &tokens) == -1) {
+            continue;
+        }
 
-        // Check for background execution
+        // Check if the command should run in the background (ends with '&')
         int bg = 0;
-        if (input[strlen(input) - 1] == '&') {
+        if (tokens.count > 0 && tokens.tokens[tokens.count - 1].type == TOK_BG) {
             bg = 1;
-            input[strlen(input) - 1] = 0; // Remove '&'
+            tokens.count--; // Remove '&' from the command
         }
-
-        // Tokenize input into arguments
-        char *token = strtok(input, " ");
-        int i = 0;
-        while (token != NULL) {
-            args[i++] = token;
-            token = strtok(NULL, " ");
-        }
-        args[i] = NULL; // Null-terminate the argument list
+        int i = lex_argv(&tokens, args, MAX_ARGS);
 
         if (i > 0) {
-            pid_t pid = fork(); // Create a child process
+            // Start the command with posix_spawn (see launcher.h) instead of fork+execvp.
+            // SIGCHLD stays blocked until a foreground child has been reaped
+            // here, so the handler never takes it first
+            sigset_t chld;
+            sigemptyset(&chld);
+            sigaddset(&chld, SIGCHLD);
+            sigprocmask(SIG_BLOCK, &chld, NULL);
+            pid_t pid = launch_argv(args);
             if (pid < 0) {
-                perror("Fork failed");
-                exit(1);
-            }
-
-            if (pid == 0) { // Child process
-                if (execvp(args[0], args) < 0) {
-                    perror("Execution failed");
-                    exit(1);
-                }
-            } else { // Parent process
-                if (bg) {
-                    job_number++; // Increment job number for each background job
-                    printf("[%d] %d\n", job_number, pid); // Print job number and PID
-                } else {
-                    waitpid(pid, NULL, 0); // Wait for foreground process
-                }
+                // Launcher already reported the error
+            } else if (bg) {
+                job_number++; // Increment job number for each background job
+                printf("[%d] %d\n", job_number, pid); // Print job number and PID
+            } else {
+                int status;
+                struct rusage ru;
+                uint64_t started = stats_now_ns();
+                wait4(pid, &status, 0, &ru); // Wait for foreground process
+                stats_child(&ru, stats_now_ns() - started);
             }
+            sigprocmask(SIG_UNBLOCK, &chld, NULL);
         }
     }
+    token_list_free(&tokens);
+    reader_close(&reader);
     return 0;
 }
@@ -1,60 +1,57 @@
+#define _GNU_SOURCE  // memmem() in histindex.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <errno.h>
 #include <signal.h>
+#include "launcher.h"
+#include "input.h"
+#include "lexer.h"
+#include "history.h"
+#include "histindex.h"
 
-#define MAX_LINE 1024     // Maximum length of a command line input
 #define MAX_ARGS 100      // Maximum number of arguments in a command
-#define HISTORY_SIZE 10   // Number of commands to keep in the history
 
-// Array to store the last 10 commands
-char history[HISTORY_SIZE][MAX_LINE];
-int history_count = 0;  // Keeps track of the number of commands in history
-
-// Adds a command to the history array
+// Adds a command to the history ring and the history file (see history.h), O(1)
 void add_to_history(const char *command) {
-    if (history_count < HISTORY_SIZE) {
-        // If history is not full, add the command to the end
-        strcpy(history[history_count++], command);
-    } else {
-        // If history is full, move all commands up one position to make space
-        for (int i = 1; i < HISTORY_SIZE; i++) {
-            strcpy(history[i - 1], history[i]);
-        }
-        strcpy(history[HISTORY_SIZE - 1], command);  // Place new command at the end
-    }
+    history_add(command);
 }
 
 // Displays the list of commands in the history
 void print_history() {
-    int start = history_count < HISTORY_SIZE ? 0 : history_count - HISTORY_SIZE;
-    for (int i = start; i < history_count; i++) {
-        printf("%d %s\n", i + 1, history[i]);  // Print command number and text
-    }
+    history_print(0);  // Print command number and text
 }
 
 // Handles the SIGCHLD signal to clean up finished background processes
 void sigchld_handler(int signo) {
-    // Use a loop to "reap" zombie processes without waiting
-    while (waitpid(-1, NULL, WNOHANG) > 0);
+    // Reap finished children without waiting, wait4() also hands back their
+    // resource usage (see stats.h)
+    int saved = errno, status;
+    struct rusage ru;
+    while (wait4(-1, &status, WNOHANG, &ru) > 0) stats_usage(&ru);
+    errno = saved;
 }
 
-// Get the correct history index based on user input
-int get_history_index(int index) {
+// Get the correct history index based on user input (zero based, absolute)
+long get_history_index(long index) {
     if (index < 0) {
-        return history_count + index; // Adjust negative index
+        return (long)history_count() + index; // Adjust negative index
     } else {
         return index; // Return directly for positive indices
     }
 }
 
-int main() {
-    char input[MAX_LINE];     // Store the user's command input
-    char *args[MAX_ARGS];     // Array to store command arguments
-    struct sigaction sa;      // Struct to manage signal handling
+int main(int argc, char *argv[]) {
+    char *input;               // Store the user's command input (owned by the reader)
+    struct line_reader reader; // Buffered terminal/script input (see input.h)
+    char *repeat = NULL;       // Command recalled from history with !N
+    char *args[MAX_ARGS];      // Array to store command arguments
+    struct token_list tokens = { 0 }; // Reused for every line (see lexer.h)
+    struct sigaction sa;       // Struct to manage signal handling
 
     // Set up the SIGCHLD signal handler to manage background processes
     sa.sa_handler = sigchld_handler;
@@ -62,42 +59,53 @@ int main() {
     sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
     sigaction(SIGCHLD, &sa, NULL);
 
+    // Commands come from -c, a script file or stdin, prompts only on a terminal
+    if (reader_from_args(&reader, argc, argv, 1) == -1) {
+        return 1;
+    }
+
     int job_number = 0;  // Tracks the background job number
 
     while (1) {
-        // Display a prompt to the user
-        printf("PUCITshell:- ");
-
-        // Get the user's input
-        if (fgets(input, MAX_LINE, stdin) == NULL) {
+        // Prompt the user (terminal only) and read the next command
+        if ((input = read_line(&reader, "PUCITshell:- ")) == NULL) {
             break; // Exit the shell if the user presses Ctrl+D
         }
 
-        // Remove the newline character from the end of the input
-        input[strcspn(input, "\n")] = 0;
-
-        // Add the command to history if it's not a repeat command
-        if (input[0] != '!' && strlen(input) > 0) {
+        // Add the command to history if it's not a repeat command. Only typed
+        // commands are recorded, -c and script lines are not
+        if (reader.interactive && input[0] != '!' && strlen(input) > 0) {
             add_to_history(input);
         }
 
         // Check if the command is a request to repeat a previous command
         if (input[0] == '!') {
-            int index;
-            if (input[1] == '-') {
+            long index;
+            if (input[1] == '?') {
+                // If the input is "!?text", repeat the newest command containing text
+                index = (long)history_search_latest(&input[2]) - 1;
+                if (index < 0) {
+                    printf("No such command in history.\n");
+                    continue;
+                }
+            } else if (input[1] == '-') {
                 // If the input is "!-N", repeat the Nth command from the end
-                index = -atoi(&input[2]); // Convert the negative number correctly
+                index = -atol(&input[2]); // Convert the negative number correctly
             } else {
                 // If the input is "!number", get the command at that index
-                index = atoi(&input[1]) - 1; // Convert to zero-based index
+                index = atol(&input[1]) - 1; // Convert to zero-based index
             }
 
             // Get the corrected index for history
             index = get_history_index(index);
 
             // Check if the index is valid, and if so, retrieve the command
-            if (index >= 0 && index < history_count) {
-                strcpy(input, history[index]); // Replace input with the command from history
+            size_t len;
+            const char *entry = index >= 0 ? history_get(index + 1, &len) : NULL;
+            if (entry != NULL) {
+                free(repeat);
+                repeat = strndup(entry, len); // Replace input with the command from history
+                input = repeat;
                 printf("Repeating command: %s\n", input);
             } else {
                 printf("No such command in history.\n");
@@ -105,46 +113,58 @@ int main() {
             }
         }
 
-        // Check if the command should run in the background
-        int bg = 0;
-        if (input[strlen(input) - 1] == '&') {
-            bg = 1;                     // Set background flag to true
-            input[strlen(input) - 1] = 0; // Remove '&' from the command
+        // "history" lists the history, "history search <text>" searches it (see histindex.h)
+        if (strncmp(input, "history", 7) == 0 && (input[7] == '\0' || input[7] == ' ')) {
+            if (strncmp(input + 7, " search ", 8) == 0) {
+                history_search_print(input + 15);
+            } else {
+                print_history();
+            }
+            continue;
         }
 
-        // Split the input into command and arguments
-        char *token = strtok(input, " ");
-        int i = 0;
-        while (token != NULL) {
-            args[i++] = token;
-            token = strtok(NULL, " ");
+        // Split the input into words and operators, quotes and escapes are handled (see lexer.h)
+        if (lex_line(input, &tokens) == -1) {
+            continue;
+        }
+
+        // Check if the command should run in the background (ends with '&')
+        int bg = 0;
+        if (tokens.count > 0 && tokens.tokens[tokens.count - 1].type == TOK_BG) {
+            bg = 1;
+            tokens.count--; // Remove '&' from the command
         }
-        args[i] = NULL;  // Set the last argument to NULL as required by execvp
+        int i = lex_argv(&tokens, args, MAX_ARGS);
 
         // Check if there is a command to execute
         if (i > 0) {
-            pid_t pid = fork();  // Create a new process
+            // Start the command with posix_spawn (see launcher.h) instead of fork+execvp.
+            // SIGCHLD stays blocked until a foreground child has been reaped
+            // here, so the handler never takes it first
+            sigset_t chld;
+            sigemptyset(&chld);
+            sigaddset(&chld, SIGCHLD);
+            sigprocmask(SIG_BLOCK, &chld, NULL);
+            pid_t pid = launch_argv(args);
             if (pid < 0) {
-                perror("Fork failed");  // Handle fork error
-                exit(1);
-            }
-
-            if (pid == 0) { // Child process
-                if (execvp(args[0], args) < 0) { // Run the command
-                    perror("Execution failed"); // Handle execvp error
-                    exit(1);
-                }
-            } else { // Parent process
-                if (bg) {
-                    // For background processes, print job number and PID
-                    job_number++;
-                    printf("[%d] %d\n", job_number, pid);
-                } else {
-                    // Wait for the child process if it's not in the background
-                    waitpid(pid, NULL, 0);
-                }
+                // Launcher already reported the error
+            } else if (bg) {
+                // For background processes, print job number and PID
+                job_number++;
+                printf("[%d] %d\n", job_number, pid);
+            } else {
+                // Wait for the child process if it's not in the background
+                int status;
+                struct rusage ru;
+                uint64_t started = stats_now_ns();
+                wait4(pid, &status, 0, &ru);
+                stats_child(&ru, stats_now_ns() - started);
             }
+            sigprocmask(SIG_UNBLOCK, &chld, NULL);
         }
     }
+    free(repeat);
+    token_list_free(&tokens);
+    reader_close(&reader);
     return 0;
 }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE  // memmem() in histindex.h, cpu_set_t in placement.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,210 +8,571 @@
 #include <signal.h>
 #include <errno.h>
 #include <limits.h>
+#include <fcntl.h>
+#include "launcher.h"
+#include "input.h"
+#include "history.h"
+#include "histindex.h"
+#include "jobs.h"
+#include "evloop.h"
+#include "builtins.h"
+#include "lexer.h"
+#include "pipeline.h"
+#include "redirect.h"
+#include "hotbuiltins.h"
+#include "placement.h"
+#include "cgroup.h"
 
 #define MAX_LINE 1024     // Maximum size of the input line
 #define MAX_ARGS 100      // Maximum number of arguments in a command
-#define HISTORY_SIZE 10   // History size to store the last 10 commands
-#define MAX_BG_JOBS 100   // Maximum number of background jobs
+#define PARALLEL_OWNER 1  // Job table owner tag of commands started by parallel
+#define PIPE_STAGE_OWNER 2  // Owner tag of pipeline stages before the last one, no job number
 
-// Structure to store background job information
-typedef struct {
-    pid_t pid;                    // Process ID of the background job
-    char command[MAX_LINE];       // Command executed as background job
-} Job;
+// Background jobs live in the job table of jobs.h, keyed by pid and job number
 
-// Array and counter to store background jobs
-Job bg_jobs[MAX_BG_JOBS];
-int bg_job_count = 0;
-
-// Array to store the history of last 10 commands
-char history[HISTORY_SIZE][MAX_LINE];
-int history_count = 0;
+// Where the shell reads its commands, parallel can continue reading it
+struct line_reader *shell_reader;
 
 // Function prototypes
 void add_to_history(const char *command);
 void print_history();
-void sigchld_handler(int signo);
 void print_jobs();
-void kill_job(int job_index);
-int is_builtin_command(char **args);
-void execute_builtin_command(char **args);
+void kill_job(int job_id);
+void register_builtins();
 
-// Adds a command to the history array
+// Adds a command to the history ring and the history file (see history.h), O(1)
 void add_to_history(const char *command) {
-    if (history_count < HISTORY_SIZE) {
-        // Add command to history if there is space
-        strcpy(history[history_count++], command);
-    } else {
-        // If history is full, shift commands up and add the new command at the end
-        for (int i = 1; i < HISTORY_SIZE; i++) {
-            strcpy(history[i - 1], history[i]);
-        }
-        strcpy(history[HISTORY_SIZE - 1], command);
-    }
+    history_add(command);
 }
 
 // Displays the history of commands
 void print_history() {
-    for (int i = 0; i < history_count && i < HISTORY_SIZE; i++) {
-        printf("%d %s\n", i + 1, history[i]);  // Print each command with its index
-    }
-}
-
-// Handles SIGCHLD to clean up finished background processes
-void sigchld_handler(int signo) {
-    int status;
-    pid_t pid;
-    // Iterate over the background jobs array to find finished jobs
-    for (int i = 0; i < bg_job_count; i++) {
-        pid = waitpid(bg_jobs[i].pid, &status, WNOHANG); // Non-blocking check
-        if (pid > 0) {  // Job has finished
-            printf("[Finished] %s\n", bg_jobs[i].command);
-            // Shift jobs array to remove completed job
-            for (int j = i; j < bg_job_count - 1; j++) {
-                bg_jobs[j] = bg_jobs[j + 1];
-            }
-            bg_job_count--; // Decrease job count
-            i--; // Adjust index after removal
-        }
-    }
+    history_print(0);  // Print each command with its number
 }
 
 // Lists currently running background jobs
 void print_jobs() {
-    for (int i = 0; i < bg_job_count; i++) {
-        printf("[%d] %d %s\n", i + 1, bg_jobs[i].pid, bg_jobs[i].command); // Print each job's info
+    for (struct job *j = jobs.head; j != NULL; j = j->next) {
+        if (j->id == 0) continue; // An inner pipeline stage, shown as its last stage, or parallel's
+        // Print each job's info, with the CPUs and scheduling it really runs with
+        char where[320];
+        placement_describe(j->pid, where, sizeof(where));
+        if (where[0] && j->cgroup) {
+            // Usage and pressure of its cgroup too (see cgroup.h)
+            char usage[256];
+            limits_describe(j->cgroup->path, usage, sizeof(usage));
+            printf("[%d] %d %s  (%s, %s)\n", j->id, j->pid, j->command, where, usage);
+        } else if (where[0]) {
+            printf("[%d] %d %s  (%s)\n", j->id, j->pid, j->command, where);
+        } else {
+            printf("[%d] %d %s\n", j->id, j->pid, j->command);
+        }
     }
 }
 
-// Terminates a background job by job number
-void kill_job(int job_index) {
-    if (job_index < 0 || job_index >= bg_job_count) {
+// Terminates a background job by job number, a pipeline with all its stages
+void kill_job(int job_id) {
+    struct job *j = job_by_id(job_id);
+    if (j == NULL || j->owner != 0 || job_by_pid(j->pid) != j) { // unknown or already finished
         printf("Invalid job number.\n");  // Check if job number is valid
         return;
     }
-    if (kill(bg_jobs[job_index].pid, SIGKILL) == 0) {
-        printf("Job %d terminated.\n", job_index + 1); // Confirm job termination
+    if (kill(j->pid, SIGKILL) == 0) {
+        for (struct job *s = jobs.head; s != NULL; s = s->next) {
+            if (s->owner == PIPE_STAGE_OWNER && s->leader == job_id) kill(s->pid, SIGKILL);
+        }
+        printf("Job %d terminated.\n", job_id); // Confirm job termination
     } else {
         perror("Failed to kill job"); // Error if job couldn't be killed
     }
 }
 
-// Check if a command is built-in and handle it if so
-int is_builtin_command(char **args) {
-    // Check if command is a built-in (e.g., "cd", "exit", "jobs")
-    if (strcmp(args[0], "cd") == 0 || strcmp(args[0], "exit") == 0 ||
-        strcmp(args[0], "jobs") == 0 || strcmp(args[0], "kill") == 0 ||
-        strcmp(args[0], "help") == 0) {
-        return 1;
+// Builtin handlers, looked up by name in the builtin registry (see builtins.h)
+void builtin_cd(char **args, char *rest) {
+    // Change directory if "cd" is provided
+    if (args[1] == NULL) {
+        fprintf(stderr, "cd: missing argument\n");
+    } else if (chdir(args[1]) != 0) {
+        perror("cd failed");  // Error if chdir fails
     }
-    return 0;
 }
 
-// Executes built-in commands directly without forking
-void execute_builtin_command(char **args) {
-    if (strcmp(args[0], "cd") == 0) {
-        // Change directory if "cd" is provided
-        if (args[1] == NULL) {
-            fprintf(stderr, "cd: missing argument\n");
-        } else if (chdir(args[1]) != 0) {
-            perror("cd failed");  // Error if chdir fails
-        }
-    } else if (strcmp(args[0], "exit") == 0) {
-        exit(0); // Exit the shell
-    } else if (strcmp(args[0], "jobs") == 0) {
-        print_jobs(); // List background jobs
-    } else if (strcmp(args[0], "kill") == 0) {
-        if (args[1] == NULL) {
-            fprintf(stderr, "kill: missing job number\n");
-        } else {
-            int job_index = atoi(args[1]) - 1; // Convert job number from string
-            kill_job(job_index); // Kill the specified job
+void builtin_exit(char **args, char *rest) {
+    exit(0); // Exit the shell
+}
+
+void builtin_jobs(char **args, char *rest) {
+    print_jobs(); // List background jobs
+}
+
+void builtin_kill(char **args, char *rest) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "kill: missing job number\n");
+    } else {
+        kill_job(atoi(args[1])); // Kill the specified job
+    }
+}
+
+void builtin_hash(char **args, char *rest) {
+    hash_builtin(args); // Show or reset the PATH lookup cache (pathhash.h)
+}
+
+void builtin_history(char **args, char *rest) {
+    if (args[1] != NULL && strcmp(args[1], "search") == 0) {
+        // Rejoin the words of the pattern, the tokenizer split them on spaces
+        char pattern[MAX_LINE] = "";
+        for (int i = 2; args[i] != NULL; i++) {
+            if (i > 2) strncat(pattern, " ", sizeof(pattern) - strlen(pattern) - 1);
+            strncat(pattern, args[i], sizeof(pattern) - strlen(pattern) - 1);
         }
-    } else if (strcmp(args[0], "help") == 0) {
-        // Display help for built-in commands
-        printf("Built-in commands:\n");
-        printf("cd <directory>: Change the current working directory.\n");
-        printf("exit: Exit the shell.\n");
-        printf("jobs: List background jobs.\n");
-        printf("kill <job_number>: Kill a background job.\n");
-        printf("help: Show this help message.\n");
+        history_search_print(pattern); // Indexed substring search (see histindex.h)
+    } else {
+        print_history();
     }
 }
 
-int main() {
-    char input[MAX_LINE];
-    char *args[MAX_ARGS];
-    struct sigaction sa;
+void builtin_help(char **args, char *rest) {
+    // Display help for built-in commands
+    builtin_print_help();
+    printf("!N, !-N, !?text: Repeat a command from the history.\n");
+}
 
-    // Set up signal handling for SIGCHLD to clean up background jobs
-    sa.sa_handler = sigchld_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-    sigaction(SIGCHLD, &sa, NULL);
+// What the children of a "place"/"limit" line set up between fork and exec
+struct child_setup {
+    struct placement place;
+    struct limits lim;
+    int placed, limited;
+};
 
-    while (1) {
-        printf("PUCITshell:- "); // Shell prompt
+// The pre_exec hook of such a line (see launcher.h)
+int setup_child(const void *arg) {
+    const struct child_setup *setup = arg;
+    int err = setup->limited ? limits_apply(&setup->lim) : 0;
+    if (err == 0 && setup->placed) err = placement_apply(&setup->place);
+    return err;
+}
+
+// Runs a builtin stage in the shell itself with its pipe ends and "<" / ">"
+// files switched onto stdin/stdout (see redirect.h). Returns its exit status
+int run_in_shell(struct stage *st) {
+    const struct builtin *builtin = builtin_find(st->argv[0]);
+    struct fd_save save;
+    int status = 1;
+    if (redirect_push(&save, st->in_fd, st->out_fd, st->input_file, st->output_file) == 0) {
+        builtin_status = 0;
+        builtin->fn(st->argv, NULL);
+        status = builtin_status;
+        redirect_pop(&save);
+    }
+    stage_close_fds(st);
+    return status;
+}
+
+// Starts an external command, through the zygote when the shell was started
+// with -z (see zygote.h). remote tells where its exit status will come from
+pid_t start_command(char **args, int *remote) {
+    struct launch_spec spec;
+    launch_spec_init(&spec, args);
+    return zygote_launch(&spec, remote);
+}
+
+void builtin_time(char **args, char *rest) {
+    // Run a command in the foreground and report its resource usage (see stats.h)
+    if (args[1] == NULL) {
+        printf("Usage: time <command> [args...]\n");
+        return;
+    }
+    uint64_t start = stats_now_ns();
+    const struct builtin *builtin = builtin_find(args[1]);
+    if (builtin != NULL) {
+        // Builtins run inside the shell: what the shell used meanwhile, and
+        // no peak RSS, the shell's own would be meaningless
+        struct rusage before, after;
+        getrusage(RUSAGE_SELF, &before);
+        builtin->fn(args + 1, NULL);
+        getrusage(RUSAGE_SELF, &after);
+        timersub(&after.ru_utime, &before.ru_utime, &after.ru_utime);
+        timersub(&after.ru_stime, &before.ru_stime, &after.ru_stime);
+        after.ru_nvcsw -= before.ru_nvcsw;
+        after.ru_nivcsw -= before.ru_nivcsw;
+        after.ru_maxrss = -1;
+        fflush(stdout);     // its output before the report on stderr
+        stats_print_usage((stats_now_ns() - start) / 1e9, &after);
+        return;
+    }
+    int remote;
+    pid_t pid = start_command(args + 1, &remote);
+    if (pid < 0) return;
+    wait_foreground(pid, remote);
+    stats_print_usage((stats_now_ns() - start) / 1e9, &evl.fg_usage);
+}
+
+void builtin_place(char **args, char *rest) {
+    // Only reached without a command, execute_line() handles "place ... command"
+    printf("usage: place [-c cpus] [-s core|node] [-n nice] [-b] command...\n");
+}
+
+void builtin_limit(char **args, char *rest) {
+    // Only reached without a command, execute_line() handles "limit ... command"
+    printf("usage: limit [-c cpu%%] [-m size] [-i dev=rate] command...\n");
+}
+
+void builtin_timeout(char **args, char *rest) {
+    // Only reached without a command, execute_line() handles "timeout ... command"
+    printf("usage: timeout [-k grace] seconds command...\n");
+}
+
+void builtin_stats(char **args, char *rest) {
+    // Spawn/wait latency percentiles and the usage of every child so far
+    stats_print();
+}
+
+// Starts one line of a parallel run, a pipeline with its redirections like
+// any command line (see pipeline.h). Its stages are quiet jobs without a
+// number, the last one owned by the parallel builtin, the others reaped
+// as with a background pipeline. Returns 1 when started, 0 for an empty line and -1 if it could
+// not start
+int parallel_launch(char *line) {
+    static struct pipeline pl = { .launch = zygote_launch };
+    char *command = strdup(line);
+    if (parse_pipeline(line, &pl) == -1 || pl.count == 0) {
+        free(command);
+        return pl.count == 0 ? 0 : -1;
+    }
+    start_pipeline(&pl);
+    for (int i = pl.count - 1; i >= 0; i--) {
+        struct stage *st = &pl.stages[i];
+        if (st->pid < 0) continue;  // the launcher reported it
+        int last = i == pl.count - 1;
+        struct job *j = last ? job_add_quiet(st->pid, command, PARALLEL_OWNER)
+                             : job_add_quiet(st->pid, st->argv[0], PIPE_STAGE_OWNER);
+        j->remote = st->remote;
+        watch_job(j);
+    }
+    free(command);
+    return pl.stages[pl.count - 1].pid > 0 ? 1 : -1;
+}
+
+// parallel [-j N] [file]: runs the command lines of file (or of stdin) with
+// exactly N of them running at a time, N defaults to the number of cores.
+// A new command starts as soon as one exits, driven by the job table reaping
+void builtin_parallel(char **args, char *rest) {
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    int a = 1;
+    if (args[a] != NULL && strcmp(args[a], "-j") == 0 && args[a + 1] != NULL) {
+        slots = atol(args[a + 1]);
+        a += 2;
+    } else if (args[a] != NULL && strncmp(args[a], "-j", 2) == 0 && args[a][2] != '\0') {
+        slots = atol(args[a] + 2);
+        a++;
+    }
+    if (slots < 1) {
+        fprintf(stderr, "parallel: -j needs a positive number\n");
+        return;
+    }
 
-        // Read input from the user
-        if (fgets(input, MAX_LINE, stdin) == NULL) {
-            break; // Exit on Ctrl+D
+    // Commands come from the file, or from stdin (continuing the shell's own input if that is stdin)
+    struct line_reader own, *in = &own;
+    if (args[a] != NULL) {
+        int fd = open(args[a], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror(args[a]);
+            return;
         }
-        input[strcspn(input, "\n")] = 0; // Remove newline
+        if (reader_init_fd(&own, fd) == -1) {
+            close(fd);
+            return;
+        }
+    } else if (shell_reader->fd == STDIN_FILENO) {
+        in = shell_reader;
+    } else if (reader_init_fd(&own, STDIN_FILENO) == -1) {
+        return;
+    }
 
-        // Add non-history commands to history array
-        if (input[0] != '!' && strlen(input) > 0) {
-            add_to_history(input);
+    double t0 = job_clock();
+    long running = 0, started = 0, failed = 0;
+    int input_done = 0, interrupted = 0;
+    while (1) {
+        // Top up to the limit, then wait for any one of them to finish
+        while (!input_done && !interrupted && running < slots) {
+            char *line = read_line(in, NULL);
+            if (line == NULL) {
+                input_done = 1;
+            } else {
+                int r = parallel_launch(line);
+                if (r != 0) started++;
+                if (r > 0) running++;
+                if (r < 0) failed++;
+            }
         }
+        if (running == 0) break;
+        if (event_loop_wait(0) == EV_INTERRUPT) interrupted = 1;
 
-        // Check if command is background (ends with '&')
-        int bg = 0;
-        if (input[strlen(input) - 1] == '&') {
-            bg = 1; // Background job flag
-            input[strlen(input) - 1] = 0; // Remove '&' symbol
+        struct job *j;
+        while ((j = jobs_take_done(PARALLEL_OWNER)) != NULL) {
+            running--;
+            int code = WIFEXITED(j->status) ? WEXITSTATUS(j->status) : 128 + WTERMSIG(j->status);
+            if (code != 0) failed++;
+            printf("[parallel] exit %d %.3fs %s\n", code, job_clock() - j->started, j->command);
+            job_free(j);
         }
+        fflush(stdout);
+    }
+    printf("parallel: %ld commands, %ld failed, -j %ld, wall %.3fs%s\n", started, failed, slots,
+           job_clock() - t0, interrupted ? " (interrupted)" : "");
+    if (in == &own) reader_close(&own);
+    // Ctrl-D only ended the list, the terminal is still the shell's input
+    else if (in->interactive) in->eof = 0;
+}
+
+// Fills the builtin registry, once at startup
+void register_builtins() {
+    builtin_register("cd", builtin_cd, "cd <directory>: Change the current working directory.");
+    builtin_register("exit", builtin_exit, "exit: Exit the shell.");
+    builtin_register("jobs", builtin_jobs, "jobs: List background jobs.");
+    builtin_register("kill", builtin_kill, "kill <job_number>: Kill a background job.");
+    builtin_register("hash", builtin_hash, "hash [-r] [name...]: Show, reset or fill the command path cache.");
+    builtin_register("history", builtin_history, "history [search <text>]: List or search the command history.");
+    builtin_register("parallel", builtin_parallel, "parallel [-j N] [file]: Run the command lines of file or stdin, N at a time.");
+    builtin_register("time", builtin_time, "time <command>: Run a command and show its time and resource usage.");
+    builtin_register("place", builtin_place, "place [-c cpus] [-s core|node] [-n nice] [-b] <command>: Run a command pinned to CPUs, spread out or at lower priority.");
+    builtin_register("limit", builtin_limit, "limit [-c cpu%] [-m size] [-i dev=rate] <command>: Run a command in its own cgroup with cpu, memory and io limits.");
+    builtin_register("timeout", builtin_timeout, "timeout [-k grace] <seconds> <command>: Run a command with a deadline, SIGTERM then SIGKILL after the grace period.");
+    builtin_register("stats", builtin_stats, "stats: Show command latency percentiles and total child resource usage.");
+    builtin_register("help", builtin_help, "help: Show this help message.");
+    register_hot_builtins(); // echo, true, false, pwd, test, printf (see hotbuiltins.h)
+}
+
+// Frees the finished inner stages of background pipelines, they are not reported
+void free_pipe_stages() {
+    struct job *j;
+    while ((j = jobs_take_done(PIPE_STAGE_OWNER)) != NULL) {
+        job_free(j);
+    }
+}
+
+// Runs one command line: history, !-recall, builtins or an external command
+void execute_line(char *input) {
+    static char *repeat = NULL; // Command recalled from history
 
-        // Parse input into arguments
-        char *token = strtok(input, " ");
-        int i = 0;
-        while (token != NULL) {
-            args[i++] = token;
-            token = strtok(NULL, " ");
+    // Add non-history commands to history array, typed ones only: -c and
+    // script lines are not recorded
+    if (shell_reader->interactive && input[0] != '!' && strlen(input) > 0) {
+        add_to_history(input);
+    }
+
+    // Repeat a command from history: !N, !-N (from the end) or !?text (newest match)
+    if (input[0] == '!') {
+        size_t n, len;
+        if (input[1] == '?') {
+            n = history_search_latest(&input[2]);
+        } else if (input[1] == '-') {
+            n = history_count() + 1 - atol(&input[2]);
+        } else {
+            n = atol(&input[1]);
+        }
+        const char *entry = n > 0 ? history_get(n, &len) : NULL;
+        if (entry == NULL) {
+            printf("No such command in history.\n");
+            return;
         }
-        args[i] = NULL;
+        free(repeat);
+        input = repeat = strndup(entry, len);
+        printf("Repeating command: %s\n", input);
+    }
 
-        if (i == 0) continue; // Skip empty commands
+    // Keep the whole line for the job table, parsing cuts it up
+    char *command_text = strdup(input);
 
-        // Check and execute built-in commands
-        if (is_builtin_command(args)) {
-            execute_builtin_command(args);
+    // Split into pipeline stages with their redirections (see pipeline.h)
+    static struct pipeline pl = { .launch = zygote_launch };
+    if (parse_pipeline(input, &pl) == -1 || pl.count == 0) { // Skip empty commands
+        free(command_text);
+        return;
+    }
+
+    // Check if command is background (ends with '&')
+    int bg = pl.background;
+    if (bg) {
+        char *amp = strrchr(command_text, '&'); // Remove '&' symbol
+        *amp = 0;
+        for (int k = amp - command_text - 1; k >= 0 && (command_text[k] == ' ' || command_text[k] == '\t'); k--)
+            command_text[k] = 0;
+    }
+
+    // "place [options]" and "limit [options]" in front of the command set up
+    // every stage in the child between fork and exec (see placement.h and
+    // cgroup.h), "timeout [-k grace] secs" gives every stage a deadline (see
+    // timeouts.h). They can be combined
+    static struct child_setup setup;
+    struct stage *first = &pl.stages[0];
+    double secs = 0, grace = 0;
+    setup.placed = setup.limited = 0;
+    while (first->argc > 1 && (strcmp(first->argv[0], "place") == 0 || strcmp(first->argv[0], "limit") == 0 ||
+                               strcmp(first->argv[0], "timeout") == 0)) {
+        int limit = first->argv[0][0] == 'l', timed = first->argv[0][0] == 't';
+        int used = timed ? timeout_parse(first->argv + 1, &secs, &grace)
+                 : limit ? limits_parse(first->argv + 1, &setup.lim)
+                 : placement_parse(first->argv + 1, &setup.place);
+        if (used == -1) {
+            free(command_text);
+            return;
+        }
+        if (limit) setup.limited = 1;
+        else if (!timed) setup.placed = 1;
+        memmove(first->argv, first->argv + 1 + used, (first->argc - used) * sizeof(char *));
+        first->argc -= used + 1;
+    }
+    int placed = setup.placed || setup.limited;
+    if (placed) {
+        if (setup.limited) limits_create(&setup.lim, zyg.pid);
+        pl.pre_exec = setup_child;
+        pl.pre_exec_arg = &setup;
+    }
+
+    // Builtins run in the shell, from the last stage back so a builtin never
+    // writes into a pipe that only another builtin would read (it could fill
+    // up). A lone builtin, with "&" too, still runs in the shell as it always
+    // did; inside a pipeline only the hot ones do (see hotbuiltins.h), the
+    // rest are started like any other command and cannot touch the shell.
+    // "command name" always runs the external program, and so does every
+    // stage of a timed line
+    for (int i = pl.count - 1; i >= 0; i--) {
+        struct stage *st = &pl.stages[i];
+        if (strcmp(st->argv[0], "command") == 0 && st->argc > 1) {
+            memmove(st->argv, st->argv + 1, st->argc-- * sizeof(char *));
             continue;
         }
+        const struct builtin *builtin = builtin_find(st->argv[0]);
+        st->in_shell = !placed && secs == 0 && builtin != NULL &&
+                       (pl.count == 1 || (!bg && builtin_is_hot(builtin))) &&
+                       (i == pl.count - 1 || !pl.stages[i + 1].in_shell);
+    }
 
-        // Handle external commands using fork and execvp
-        pid_t pid = fork();
-        if (pid < 0) {
-            perror("Fork failed");
-            exit(1);
+    // Handle external stages using posix_spawn (see launcher.h), or the zygote,
+    // all of them started before any builtin stage runs
+    start_pipeline(&pl);
+    if (setup.limited) limits_started(&setup.lim);
+    for (int i = 0; i < pl.count; i++) {
+        struct stage *st = &pl.stages[i];
+        if (st->in_shell) {
+            st->status = run_in_shell(st) << 8;
         }
-        if (pid == 0) { // Child process
-            if (execvp(args[0], args) < 0) {
-                perror("Execution failed"); // Error if exec fails
-                exit(1);
+    }
+
+    // A background pipeline adds its last stage first, so that job gets the
+    // next job number. Background deadlines live in the job table, foreground
+    // ones only until the line is done
+    struct timeout *deadlines = NULL;
+    if (secs > 0 && !bg) {
+        deadlines = calloc((unsigned)pl.count, sizeof(*deadlines));
+        for (int i = 0; i < pl.count; i++) {
+            deadlines[i].index = -1;
+            if (pl.stages[i].pid > 0) timeout_arm(&deadlines[i], pl.stages[i].pid, secs, grace);
+        }
+    }
+    // Every job of a background line shares its group, the last to go removes it
+    struct job_cgroup *group = bg && setup.limited && setup.lim.cgroup[0] ? job_cgroup_new(setup.lim.cgroup) : NULL;
+    int leader = 0;     // job number of the background line
+    for (int k = 0; k < pl.count; k++) {
+        int i = bg ? pl.count - 1 - k : k;
+        struct stage *st = &pl.stages[i];
+        if (st->pid < 0) {
+            // Launcher already reported the error, or a builtin stage
+        } else if (bg) { // For background jobs, no limit on their number
+            // The last stage stands for the pipeline with the job number, the
+            // others are quiet jobs, reaped without a report
+            int last = i == pl.count - 1;
+            struct job *j = last ? job_add(st->pid, command_text)
+                                 : job_add_quiet(st->pid, st->argv[0], PIPE_STAGE_OWNER);
+            j->remote = st->remote;
+            if (last) leader = j->id;
+            else j->leader = leader;
+            if (group) {
+                j->cgroup = group;
+                group->refs++;
             }
-        } else { // Parent process
-            if (bg) { // For background jobs
-                if (bg_job_count < MAX_BG_JOBS) {
-                    bg_jobs[bg_job_count].pid = pid;
-                    strcpy(bg_jobs[bg_job_count].command, input);
-                    printf("[%d] %d\n", ++bg_job_count, pid); // Show job info
-                } else {
-                    printf("Max background jobs reached.\n");
-                }
-            } else {
-                waitpid(pid, NULL, 0); // Wait for foreground job to finish
+            if (secs > 0) timeout_arm(&j->timeout, st->pid, secs, grace);
+            watch_job(j);
+            if (last) printf("[%d] %d\n", j->id, st->pid); // Show job info
+        } else {
+            // Wait for each foreground stage, background jobs are still handled meanwhile
+            st->status = wait_foreground(st->pid, st->remote);
+            if (deadlines) {
+                timeout_disarm(&deadlines[i]);
+                if (deadlines[i].fired)
+                    fprintf(stderr, "timeout: %s timed out after %gs\n", st->argv[0], secs);
+            }
+        }
+    }
+    free(deadlines);
+    // A foreground line's group is empty now, and so is a background one's
+    // when none of its stages started
+    if (!bg && setup.limited && setup.lim.cgroup[0]) limits_remove(setup.lim.cgroup);
+    if (group && group->refs == 0) job_cgroup_put(group);
+    free(command_text);
+}
+
+// The main loop waits in one epoll set (see evloop.h): stdin, a signalfd
+// for SIGCHLD/SIGINT and one pidfd per child. Job completion, prompt redraw
+// and input all happen there, no signal handler races with the main loop.
+// usage: myshellv5 [-z] [-c commands | script], -z starts commands through
+// a zygote forked before anything else (see zygote.h)
+int main(int argc, char *argv[]) {
+    struct line_reader reader;  // Buffered terminal/script input (see input.h)
+    char *input;
+    int first = 1;
+
+    if (argc > 1 && strcmp(argv[1], "-z") == 0) {
+        zygote_start(ev_zygote_child); // Falls back to local launches if it fails
+        first = 2;
+    }
+
+    // Commands come from -c, a script file or stdin, prompts only on a terminal
+    if (reader_from_args(&reader, argc, argv, first) == -1) {
+        return 1;
+    }
+    if (event_loop_init(reader.fd) == -1) {
+        return 1;
+    }
+    register_builtins();
+    shell_reader = &reader;
+
+    int prompt = 1;
+    while (1) {
+        // Run every complete line that is already buffered
+        while ((input = reader_next(&reader)) != NULL) {
+            execute_line(input);
+            free_pipe_stages();
+            jobs_report();
+            prompt = 1;
+        }
+        if (reader.eof) {
+            break; // Exit on Ctrl+D or at the end of the script
+        }
+        if (prompt && reader.interactive) {
+            printf("PUCITshell:- "); // Shell prompt
+        }
+        fflush(stdout);
+        prompt = 0;
+
+        // Sleep until input arrives, redrawing the prompt when jobs finish meanwhile
+        int ev = event_loop_wait(1);
+        if (ev == EV_INPUT) {
+            if (reader_fill(&reader) < 0 && errno != EINTR) {
+                perror("read");
+                break;
             }
+        } else if (ev == EV_INTERRUPT || (ev == EV_JOBS && jobs.done_head)) {
+            free_pipe_stages();
+            if (ev == EV_JOBS && jobs.done_head == NULL) continue; // Only inner pipeline stages finished
+            if (reader.interactive) printf("\n");
+            jobs_report();
+            prompt = 1;
         }
     }
+    reader_close(&reader);
+    zygote_stop();
+    limits_cleanup();   // groups of jobs that were still running
     return 0;
 }
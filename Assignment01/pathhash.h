@@ -0,0 +1,204 @@
+/*
+*  pathhash.h: bash style "hash" table of resolved command paths
+*  execvp() walks $PATH and tries execve() in every directory until one works,
+*  on every single command. path_hash_lookup() does that walk once per command
+*  name (with access() instead of failed execve() calls) and remembers the
+*  absolute path in an open addressing table, so later runs go straight to it.
+*  The table is dropped when PATH changes (path_hash_set_path(), called from
+*  set_var()/export_var() in version6.c) and a single entry is dropped when its
+*  binary disappears (path_hash_forget(), called by the launcher on ENOENT).
+*  hash_builtin() implements the "hash" and "hash -r" builtins.
+*/
+#ifndef PATHHASH_H
+#define PATHHASH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PATH_HASH_MIN_SLOTS 64
+
+struct path_hash_entry {
+    char *name;         // command name as typed, NULL for an empty slot
+    char *path;         // resolved absolute path
+    unsigned long hits; // number of lookups answered from this entry
+};
+
+struct path_hash {
+    struct path_hash_entry *slots;
+    size_t capacity;    // always a power of two
+    size_t count;
+    char *search_path;  // PATH the entries were resolved against
+    int path_set;       // search_path has been initialised
+    unsigned long hits, misses;
+};
+
+static struct path_hash cmd_hash;
+
+// FNV-1a, good enough for short command names
+static inline size_t path_hash_str(const char *s) {
+    size_t h = 14695981039346656037UL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+// Removes every entry, keeps the counters
+static inline void path_hash_clear(void) {
+    for (size_t i = 0; i < cmd_hash.capacity; i++) {
+        free(cmd_hash.slots[i].name);
+        free(cmd_hash.slots[i].path);
+    }
+    free(cmd_hash.slots);
+    cmd_hash.slots = NULL;
+    cmd_hash.capacity = cmd_hash.count = 0;
+}
+
+// Sets the search path and drops the table if it differs from the old one
+static inline void path_hash_set_path(const char *path) {
+    if (path == NULL) path = "";
+    if (cmd_hash.path_set && strcmp(cmd_hash.search_path, path) == 0)
+        return;
+    free(cmd_hash.search_path);
+    cmd_hash.search_path = strdup(path);
+    cmd_hash.path_set = 1;
+    path_hash_clear();
+}
+
+static inline struct path_hash_entry *path_hash_find(const char *name) {
+    if (cmd_hash.capacity == 0) return NULL;
+    size_t mask = cmd_hash.capacity - 1;
+    for (size_t i = path_hash_str(name) & mask; cmd_hash.slots[i].name; i = (i + 1) & mask) {
+        if (strcmp(cmd_hash.slots[i].name, name) == 0)
+            return &cmd_hash.slots[i];
+    }
+    return NULL;
+}
+
+static inline void path_hash_insert(char *name, char *path, unsigned long hits) {
+    if ((cmd_hash.count + 1) * 10 > cmd_hash.capacity * 7) {
+        // Grow and rehash when 70% full
+        struct path_hash_entry *old = cmd_hash.slots;
+        size_t old_cap = cmd_hash.capacity;
+        cmd_hash.capacity = old_cap ? old_cap * 2 : PATH_HASH_MIN_SLOTS;
+        cmd_hash.slots = calloc(cmd_hash.capacity, sizeof(*cmd_hash.slots));
+        cmd_hash.count = 0;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i].name)
+                path_hash_insert(old[i].name, old[i].path, old[i].hits);
+        }
+        free(old);
+    }
+    size_t mask = cmd_hash.capacity - 1;
+    size_t i = path_hash_str(name) & mask;
+    while (cmd_hash.slots[i].name)
+        i = (i + 1) & mask;
+    cmd_hash.slots[i].name = name;
+    cmd_hash.slots[i].path = path;
+    cmd_hash.slots[i].hits = hits;
+    cmd_hash.count++;
+}
+
+// Drops one entry, e.g. when the cached binary no longer exists
+static inline void path_hash_forget(const char *name) {
+    struct path_hash_entry *e = path_hash_find(name);
+    if (e == NULL) return;
+    size_t mask = cmd_hash.capacity - 1;
+    size_t i = e - cmd_hash.slots;
+    free(e->name);
+    free(e->path);
+    e->name = e->path = NULL;
+    cmd_hash.count--;
+    // Backward shift deletion keeps the probe chains intact without tombstones
+    for (size_t j = (i + 1) & mask; cmd_hash.slots[j].name; j = (j + 1) & mask) {
+        size_t home = path_hash_str(cmd_hash.slots[j].name) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            cmd_hash.slots[i] = cmd_hash.slots[j];
+            cmd_hash.slots[j].name = cmd_hash.slots[j].path = NULL;
+            i = j;
+        }
+    }
+}
+
+// Walks the search path once, returns a malloc'ed path or NULL
+static inline char *path_hash_resolve(const char *name) {
+    const char *dir = cmd_hash.search_path;
+    size_t name_len = strlen(name);
+    while (dir) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+        char *full = malloc(dir_len + name_len + 3);
+        if (dir_len == 0) {
+            full[0] = '.';  // empty PATH entry means the current directory
+            dir_len = 1;
+        } else {
+            memcpy(full, dir, dir_len);
+        }
+        full[dir_len] = '/';
+        memcpy(full + dir_len + 1, name, name_len + 1);
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0)
+            return full;
+        free(full);
+        dir = end ? end + 1 : NULL;
+    }
+    return NULL;
+}
+
+// Returns the cached path of a command, resolving it on a miss. The result
+// belongs to the table. Names containing '/' are returned unchanged.
+static inline const char *path_hash_lookup(const char *name) {
+    if (strchr(name, '/')) return name;
+    if (!cmd_hash.path_set) {
+        const char *env = getenv("PATH");
+        path_hash_set_path(env ? env : "/usr/local/bin:/usr/bin:/bin");
+    }
+    struct path_hash_entry *e = path_hash_find(name);
+    if (e) {
+        e->hits++;
+        cmd_hash.hits++;
+        return e->path;
+    }
+    cmd_hash.misses++;
+    char *path = path_hash_resolve(name);
+    if (path == NULL) return NULL;
+    if (path[0] != '/') {
+        // Relative PATH entries depend on the cwd and are not cached
+        static char *relative;
+        free(relative);
+        return relative = path;
+    }
+    path_hash_insert(strdup(name), path, 0);
+    return path;
+}
+
+// "hash" lists the table, "hash -r" forgets everything, "hash name..." resolves names
+static inline void hash_builtin(char **args) {
+    if (args[1] && strcmp(args[1], "-r") == 0) {
+        path_hash_clear();
+        return;
+    }
+    if (args[1]) {
+        for (int i = 1; args[i]; i++) {
+            if (path_hash_lookup(args[i]) == NULL)
+                fprintf(stderr, "hash: %s: not found\n", args[i]);
+        }
+        return;
+    }
+    if (cmd_hash.count == 0) {
+        printf("hash: hash table empty\n");
+    } else {
+        printf("hits\tcommand\n");
+        for (size_t i = 0; i < cmd_hash.capacity; i++) {
+            if (cmd_hash.slots[i].name)
+                printf("%4lu\t%s\n", cmd_hash.slots[i].hits, cmd_hash.slots[i].path);
+        }
+    }
+    printf("lookups: %lu hits, %lu misses\n", cmd_hash.hits, cmd_hash.misses);
+}
+
+#endif
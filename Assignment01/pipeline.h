@@ -0,0 +1,302 @@
+/*
+*  pipeline.h: N stage pipeline engine
+*  parse_pipeline() splits a command line (tokenized by lexer.h) into any
+*  number of "|" separated stages, each with its own "<" and ">"
+*  redirections and argument vector.
+*  start_pipeline() creates every pipe up front, starts every stage at once
+*  through launch_command() and wait_pipeline() reaps them all in one wait
+*  loop, in whatever order they finish.
+*  pipe_size, when set, resizes every pipe with F_SETPIPE_SZ so high
+*  throughput stages move more data per context switch.
+*  A "cat" stage that reads files or a pipe (never the shell's own stdin) can
+*  be a copy stage instead: marked in_shell, it is run by run_copy_stage()
+*  in the shell, which moves the data with copy_fd() (see zerocopy.h), no
+*  process and no user space copy.
+*  Needs _GNU_SOURCE (pipe2, F_SETPIPE_SZ, splice) defined before the first
+*  include.
+*/
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "launcher.h"
+#include "lexer.h"
+#include "zerocopy.h"
+
+// One command of a pipeline
+struct stage {
+    char **argv;        // NULL terminated, points into the parsed line
+    int argc, cap;
+    char *input_file;   // "<" file or NULL
+    char *output_file;  // ">" file or NULL
+    pid_t pid;          // set by start_pipeline(), -1 if it failed to start
+    int remote;         // started by pl->launch as a child of another process (zygote.h)
+    int in_shell;       // run by the caller itself, start_pipeline() leaves it alone
+    int in_fd, out_fd;  // in_shell: its pipe ends, left open for the caller, -1 if none
+    int status;         // wait status, set by wait_pipeline()
+    struct rusage usage;    // from wait4(), set by wait_pipeline()
+};
+
+struct pipeline {
+    struct stage *stages;
+    int count, cap;
+    int background;     // line ended with "&"
+    int pipe_size;      // F_SETPIPE_SZ bytes for every pipe, 0 keeps the default
+    int running;        // stages started and not reaped yet
+    uint64_t started;   // when the last stage was spawned
+    // Starts one stage, launch_command() when NULL; sets *remote when the
+    // stage is not a child of the shell
+    pid_t (*launch)(const struct launch_spec *spec, int *remote);
+    // Passed on to every stage's launch_spec, see launcher.h. Cleared by
+    // parse_pipeline(), set per line
+    int (*pre_exec)(const void *arg);
+    const void *pre_exec_arg;
+};
+
+static inline void pipeline_init(struct pipeline *pl) {
+    memset(pl, 0, sizeof(*pl));
+}
+
+// Releases the stage arrays, the strings belong to the parsed line
+static inline void pipeline_free(struct pipeline *pl) {
+    for (int i = 0; i < pl->count; i++)
+        free(pl->stages[i].argv);
+    free(pl->stages);
+    pl->stages = NULL;
+    pl->count = pl->cap = 0;
+}
+
+static inline struct stage *pipeline_add_stage(struct pipeline *pl) {
+    if (pl->count == pl->cap) {
+        pl->cap = pl->cap ? pl->cap * 2 : 4;
+        pl->stages = realloc(pl->stages, pl->cap * sizeof(*pl->stages));
+    }
+    struct stage *st = &pl->stages[pl->count++];
+    memset(st, 0, sizeof(*st));
+    st->pid = -1;
+    st->in_fd = st->out_fd = -1;
+    return st;
+}
+
+static inline void stage_add_arg(struct stage *st, char *arg) {
+    if (st->argc + 1 >= st->cap) {
+        st->cap = st->cap ? st->cap * 2 : 8;
+        st->argv = realloc(st->argv, st->cap * sizeof(char *));
+    }
+    st->argv[st->argc++] = arg;
+    st->argv[st->argc] = NULL;
+}
+
+// Parses cmd in place (see lexer.h, quotes and escapes are removed in the
+// line itself). Returns 0 on success, 0 with pl->count == 0 for an empty
+// line and -1 on a syntax error.
+static inline int parse_pipeline(char *cmd, struct pipeline *pl) {
+    static struct token_list tokens;    // reused from line to line
+    int pipe_size = pl->pipe_size;
+    pid_t (*launch)(const struct launch_spec *, int *) = pl->launch;
+    pipeline_free(pl);
+    pipeline_init(pl);
+    pl->pipe_size = pipe_size;
+    pl->launch = launch;
+
+    if (lex_line(cmd, &tokens) == -1)
+        return -1;
+    struct stage *st = NULL;
+    for (size_t i = 0; i < tokens.count; i++) {
+        struct token *token = &tokens.tokens[i];
+        if (pl->background) {
+            fprintf(stderr, "syntax error: '&' must end the command\n");
+            return -1;
+        }
+        if (st == NULL)
+            st = pipeline_add_stage(pl);
+        if (token->type == TOK_IN || token->type == TOK_OUT) {
+            if (i + 1 == tokens.count || tokens.tokens[i + 1].type != TOK_WORD) {
+                fprintf(stderr, "syntax error: missing file after '%s'\n", token->text);
+                return -1;
+            }
+            char *file = tokens.tokens[++i].text;
+            if (token->type == TOK_IN)
+                st->input_file = file;
+            else
+                st->output_file = file;
+        } else if (token->type == TOK_PIPE) {
+            if (st->argc == 0) {
+                fprintf(stderr, "syntax error near '|'\n");
+                return -1;
+            }
+            st = NULL;  // next token starts a new stage
+        } else if (token->type == TOK_BG) {
+            pl->background = 1;
+        } else {
+            stage_add_arg(st, token->text);
+        }
+    }
+    if (pl->count > 0 && (st == NULL || st->argc == 0)) {
+        fprintf(stderr, "syntax error: missing command\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Starts every stage of the pipeline. All pipes are created before the first
+// child so no stage waits for another to be launched. Stages marked in_shell
+// are not started, they get their pipe ends in in_fd/out_fd instead and the
+// caller runs them and closes those with stage_close_fds(). Returns the
+// number of stages that were started.
+static inline int start_pipeline(struct pipeline *pl) {
+    int npipes = pl->count - 1;
+    int *fds = npipes > 0 ? malloc(2 * npipes * sizeof(int)) : NULL;
+
+    for (int i = 0; i < npipes; i++) {
+        if (pipe2(&fds[2 * i], O_CLOEXEC) == -1) {
+            perror("pipe failed");
+            while (--i >= 0) {
+                close(fds[2 * i]);
+                close(fds[2 * i + 1]);
+            }
+            free(fds);
+            return 0;
+        }
+        if (pl->pipe_size > 0 && fcntl(fds[2 * i], F_SETPIPE_SZ, pl->pipe_size) == -1)
+            perror("F_SETPIPE_SZ");
+    }
+
+    pl->running = 0;
+    for (int i = 0; i < pl->count; i++) {
+        struct stage *st = &pl->stages[i];
+        struct launch_spec spec;
+        launch_spec_init(&spec, st->argv);
+        // Explicit redirections take priority over the pipe ends
+        spec.in_fd = i > 0 ? fds[2 * (i - 1)] : -1;
+        spec.out_fd = i < npipes ? fds[2 * i + 1] : -1;
+        spec.input_file = st->input_file;
+        spec.output_file = st->output_file;
+        spec.pre_exec = pl->pre_exec;
+        spec.pre_exec_arg = pl->pre_exec_arg;
+        if (st->in_shell) {
+            st->in_fd = spec.in_fd;
+            st->out_fd = spec.out_fd;
+            if (i > 0) fds[2 * (i - 1)] = -1;   // not closed below
+            if (i < npipes) fds[2 * i + 1] = -1;
+            continue;
+        }
+        st->pid = pl->launch ? pl->launch(&spec, &st->remote) : launch_command(&spec);
+        st->status = st->pid > 0 ? 0 : 127 << 8;
+        if (st->pid > 0)
+            pl->running++;
+    }
+
+    pl->started = stats_now_ns();
+    // The children hold their own copies now
+    for (int i = 0; i < 2 * npipes; i++)
+        if (fds[i] != -1) close(fds[i]);
+    free(fds);
+    return pl->running;
+}
+
+// Closes the pipe ends of an in_shell stage once it has run
+static inline void stage_close_fds(struct stage *st) {
+    if (st->in_fd != -1) close(st->in_fd);
+    if (st->out_fd != -1) close(st->out_fd);
+    st->in_fd = st->out_fd = -1;
+}
+
+// Whether stage i can be a copy stage: "cat" without options, reading its
+// files, its "<" file or the pipe before it, but not the shell's stdin
+static inline int stage_is_copy(const struct pipeline *pl, int i) {
+    const struct stage *st = &pl->stages[i];
+    if (strcmp(st->argv[0], "cat") != 0) return 0;
+    for (int k = 1; k < st->argc; k++) {
+        if (st->argv[k][0] != '-') continue;
+        if (st->argv[k][1] || (i == 0 && st->input_file == NULL)) return 0;    // an option, or stdin
+    }
+    return st->argc > 1 || st->input_file || i > 0;
+}
+
+// Runs a copy stage the caller marked in_shell, after start_pipeline(), as
+// cat would: its files ("-" is its input) or else its input go to its
+// output. Returns the wait status cat would have had
+static inline int run_copy_stage(struct stage *st) {
+    int in = st->in_fd != -1 ? st->in_fd : STDIN_FILENO;
+    int out = st->out_fd != -1 ? st->out_fd : STDOUT_FILENO;
+    int opened_in = -1, opened_out = -1, status = 0;
+    if (st->output_file) {
+        opened_out = out = open(st->output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out == -1) {
+            perror("Error opening output file");
+            stage_close_fds(st);
+            return 1 << 8;
+        }
+    }
+    if (st->input_file) {
+        opened_in = in = open(st->input_file, O_RDONLY | O_CLOEXEC);
+        if (in == -1) {
+            perror("Error opening input file");
+            if (opened_out != -1) close(opened_out);
+            stage_close_fds(st);
+            return 1 << 8;
+        }
+    }
+    // The reader may be gone: EPIPE, and the status of a cat killed by SIGPIPE
+    void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+    if (out == STDOUT_FILENO) fflush(stdout);
+    for (int k = st->argc > 1 ? 1 : 0; k < st->argc; k++) {
+        const char *name = k == 0 || strcmp(st->argv[k], "-") == 0 ? NULL : st->argv[k];
+        int fd = name ? open(name, O_RDONLY | O_CLOEXEC) : in;
+        if (fd == -1 || copy_fd(fd, out) == -1) {
+            if (errno == EPIPE) {
+                status = SIGPIPE;
+                if (fd != in) close(fd);
+                break;
+            }
+            fprintf(stderr, "cat: %s: %s\n", name ? name : "-", strerror(errno));
+            status = 1 << 8;
+        }
+        if (fd != -1 && fd != in) close(fd);
+    }
+    signal(SIGPIPE, old_pipe);
+    if (opened_in != -1) close(opened_in);
+    if (opened_out != -1) close(opened_out);
+    stage_close_fds(st);
+    return status;
+}
+
+// Reaps every stage with a single wait4(-1) loop, whichever finishes first,
+// recording each stage's resource usage (see stats.h). Children that are not
+// part of the pipeline are passed to other_child when it is set. Returns the
+// wait status of the last stage.
+static inline int wait_pipeline(struct pipeline *pl, void (*other_child)(pid_t, int, const struct rusage *)) {
+    while (pl->running > 0) {
+        int status;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &status, 0, &ru);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            break;  // ECHILD: someone else reaped them
+        }
+        int found = 0;
+        for (int i = 0; i < pl->count; i++) {
+            if (pl->stages[i].pid == pid) {
+                pl->stages[i].status = status;
+                pl->stages[i].usage = ru;
+                stats_child(&ru, stats_now_ns() - pl->started);
+                pl->running--;
+                found = 1;
+                break;
+            }
+        }
+        if (!found && other_child)
+            other_child(pid, status, &ru);
+    }
+    return pl->count > 0 ? pl->stages[pl->count - 1].status : 0;
+}
+
+#endif
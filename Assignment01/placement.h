@@ -0,0 +1,202 @@
+/*
+*  placement.h: CPU affinity and scheduling of the commands a line starts
+*  "place [options] command..." starts every stage of the line with:
+*     -c LIST     CPU list as taskset -c takes it, e.g. 0-3,8,10-11
+*     -s core     the next allowed core, round robin over the shell's
+*                 affinity, so jobs started one after another spread out
+*     -s node     all cores of the next NUMA node, round robin over the nodes
+*                 in /sys/devices/system/node (the whole machine without one)
+*     -n N        niceness raised by N, as nice -n N
+*     -b          SCHED_BATCH
+*  posix_spawn() cannot change any of this in the child, so the launcher
+*  starts a placed command with fork() and runs placement_apply() between
+*  fork and exec (the pre_exec hook of launcher.h). Commands without options
+*  keep the fast spawn path, and the zygote hands placed ones back to it.
+*  placement_describe() reads what a running process actually got, for jobs.
+*  Needs _GNU_SOURCE (cpu_set_t, sched_setaffinity) defined before the first
+*  include.
+*/
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define PLACEMENT_NODE_DIR "/sys/devices/system/node"
+
+struct placement {
+    cpu_set_t cpus;
+    int has_cpus;
+    int nice;           // increment, 0 leaves it
+    int batch;          // SCHED_BATCH
+};
+
+// Round robin cursors, shared by every line of the session
+static struct {
+    unsigned next_core, next_node;
+} placement_rr;
+
+// Parses a CPU list ("0-3,8") into set, -1 if it is not one
+static inline int placement_parse_cpus(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p || lo < 0) return -1;
+        p = end;
+        if (*p == '-') {
+            hi = strtol(p + 1, &end, 10);
+            if (end == p + 1 || hi < lo) return -1;
+            p = end;
+        }
+        if (hi >= CPU_SETSIZE) return -1;
+        for (long c = lo; c <= hi; c++) CPU_SET(c, set);
+        if (*p == ',') p++;
+        else if (*p) return -1;
+    }
+    return CPU_COUNT(set) ? 0 : -1;
+}
+
+// Formats set as a CPU list, ranges collapsed
+static inline void placement_format_cpus(const cpu_set_t *set, char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int c = 0; c < CPU_SETSIZE && len < size; c++) {
+        if (!CPU_ISSET(c, set)) continue;
+        int last = c;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) last++;
+        len += snprintf(buf + len, size - len, last > c ? "%s%d-%d" : "%s%d", len ? "," : "", c, last);
+        c = last;
+    }
+}
+
+// The cpus of the next core in the shell's own affinity
+static inline void placement_next_core(cpu_set_t *set) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        CPU_ZERO(&allowed);
+        CPU_SET(0, &allowed);
+    }
+    int n = CPU_COUNT(&allowed), want = placement_rr.next_core++ % n;
+    CPU_ZERO(set);
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &allowed) && want-- == 0) {
+            CPU_SET(c, set);
+            return;
+        }
+    }
+}
+
+// Reads a one line CPU (or node) list file such as node0/cpulist
+static inline int placement_read_list(const char *path, cpu_set_t *set) {
+    char list[4096];
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+    int ok = fgets(list, sizeof(list), f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+    list[strcspn(list, "\n")] = '\0';
+    return placement_parse_cpus(list, set);
+}
+
+// The cpus of the next NUMA node that has any the shell may use
+static inline void placement_next_node(cpu_set_t *set) {
+    cpu_set_t allowed, nodes;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    if (placement_read_list(PLACEMENT_NODE_DIR "/online", &nodes) == 0) {
+        int count = CPU_COUNT(&nodes);
+        for (int tries = 0; tries < count; tries++) {
+            int want = placement_rr.next_node++ % count, node = 0;
+            for (; node < CPU_SETSIZE; node++)
+                if (CPU_ISSET(node, &nodes) && want-- == 0) break;
+            char path[128];
+            snprintf(path, sizeof(path), PLACEMENT_NODE_DIR "/node%d/cpulist", node);
+            if (placement_read_list(path, set) == -1) continue;
+            CPU_AND(set, set, &allowed);
+            if (CPU_COUNT(set)) return;
+        }
+    }
+    *set = allowed;     // no NUMA information: one node, the whole machine
+}
+
+// Reads the options in front of the command. Returns the number of words
+// they took, or -1 with the error printed
+static inline int placement_parse(char **args, struct placement *p) {
+    memset(p, 0, sizeof(*p));
+    int a = 0;
+    while (args[a] && args[a][0] == '-' && args[a][1] && args[a][2] == '\0') {
+        char opt = args[a][1];
+        const char *value = args[a + 1];
+        if (opt == 'b') {
+            p->batch = 1;
+            a++;
+            continue;
+        }
+        if (value == NULL) {
+            fprintf(stderr, "place: %s needs a value\n", args[a]);
+            return -1;
+        }
+        if (opt == 'c') {
+            if (placement_parse_cpus(value, &p->cpus) == -1) {
+                fprintf(stderr, "place: bad CPU list '%s'\n", value);
+                return -1;
+            }
+            p->has_cpus = 1;
+        } else if (opt == 's' && (strcmp(value, "core") == 0 || strcmp(value, "node") == 0)) {
+            if (value[0] == 'c') placement_next_core(&p->cpus);
+            else placement_next_node(&p->cpus);
+            p->has_cpus = 1;
+        } else if (opt == 'n') {
+            char *end;
+            p->nice = strtol(value, &end, 10);
+            if (*end || end == value) {
+                fprintf(stderr, "place: bad nice value '%s'\n", value);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "place: unknown option %s %s\n", args[a], value);
+            return -1;
+        }
+        a += 2;
+    }
+    if (args[a] == NULL) {
+        fprintf(stderr, "usage: place [-c cpus] [-s core|node] [-n nice] [-b] command...\n");
+        return -1;
+    }
+    return a;
+}
+
+// The pre_exec hook: runs in the forked child, returns 0 or an errno
+static inline int placement_apply(const void *arg) {
+    const struct placement *p = arg;
+    if (p->has_cpus && sched_setaffinity(0, sizeof(p->cpus), &p->cpus) == -1) return errno;
+    if (p->batch) {
+        struct sched_param param = { 0 };
+        if (sched_setscheduler(0, SCHED_BATCH, &param) == -1) return errno;
+    }
+    errno = 0;
+    if (p->nice && nice(p->nice) == -1 && errno != 0) return errno;
+    return 0;
+}
+
+// "cpus 0-3 nice 5 batch" for a running process, empty if it is gone
+static inline void placement_describe(pid_t pid, char *buf, size_t size) {
+    cpu_set_t set;
+    char cpus[256];
+    buf[0] = '\0';
+    if (sched_getaffinity(pid, sizeof(set), &set) == -1) return;
+    placement_format_cpus(&set, cpus, sizeof(cpus));
+    errno = 0;
+    int prio = getpriority(PRIO_PROCESS, pid);
+    int policy = sched_getscheduler(pid);
+    snprintf(buf, size, "cpus %s nice %d%s%s", cpus, errno ? 0 : prio,
+             policy == SCHED_BATCH ? " batch" : "", policy == SCHED_IDLE ? " idle" : "");
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+*  redirect.h: redirections for commands the shell runs itself
+*  A builtin in a pipeline or with "<"/">" runs in the shell process, so its
+*  stdin/stdout have to be switched around it instead of in a child.
+*  redirect_push() keeps close-on-exec copies of the descriptors it replaces
+*  and dup2()s the pipe ends and opened files over them, redirect_pop() puts
+*  the originals back. stdout is flushed at both ends so nothing printed
+*  before or after lands on the wrong descriptor.
+*  SIGPIPE is blocked while stdout is redirected: a builtin writing into a
+*  pipe nobody reads gets EPIPE instead of killing the shell, and the pending
+*  signal is dropped by redirect_pop().
+*/
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+struct fd_save {
+    int saved_in, saved_out;    // copies of stdin/stdout, -1 when not replaced
+    sigset_t oldmask;
+};
+
+// Replaces fd with the descriptor to_fd, saving the old one in *saved
+static inline void redirect_fd(int fd, int to_fd, int *saved) {
+    *saved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    dup2(to_fd, fd);
+}
+
+// Switches stdin/stdout to in_fd/out_fd (pipe ends, -1 for none) or to the
+// files, the files win. Returns -1 with the error printed if a file cannot
+// be opened, nothing is changed then
+static inline int redirect_push(struct fd_save *s, int in_fd, int out_fd, const char *input_file,
+                                const char *output_file) {
+    int opened_in = -1, opened_out = -1;
+    s->saved_in = s->saved_out = -1;
+    if (input_file) {
+        opened_in = in_fd = open(input_file, O_RDONLY | O_CLOEXEC);
+        if (in_fd == -1) {
+            perror("Error opening input file");
+            return -1;
+        }
+    }
+    if (output_file) {
+        opened_out = out_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out_fd == -1) {
+            perror("Error opening output file");
+            if (opened_in != -1) close(opened_in);
+            return -1;
+        }
+    }
+    if (in_fd != -1) redirect_fd(STDIN_FILENO, in_fd, &s->saved_in);
+    if (out_fd != -1) {
+        sigset_t pipe_mask;
+        sigemptyset(&pipe_mask);
+        sigaddset(&pipe_mask, SIGPIPE);
+        sigprocmask(SIG_BLOCK, &pipe_mask, &s->oldmask);
+        fflush(stdout);
+        redirect_fd(STDOUT_FILENO, out_fd, &s->saved_out);
+    }
+    if (opened_in != -1) close(opened_in);
+    if (opened_out != -1) close(opened_out);
+    return 0;
+}
+
+// Restores what redirect_push() replaced
+static inline void redirect_pop(struct fd_save *s) {
+    if (s->saved_out != -1) {
+        fflush(stdout);
+        clearerr(stdout);   // EPIPE from a closed reader
+        dup2(s->saved_out, STDOUT_FILENO);
+        close(s->saved_out);
+        sigset_t pipe_mask, pending;
+        sigemptyset(&pipe_mask);
+        sigaddset(&pipe_mask, SIGPIPE);
+        sigpending(&pending);
+        if (sigismember(&pending, SIGPIPE)) {
+            struct timespec zero = { 0, 0 };
+            sigtimedwait(&pipe_mask, NULL, &zero);
+        }
+        sigprocmask(SIG_SETMASK, &s->oldmask, NULL);
+    }
+    if (s->saved_in != -1) {
+        dup2(s->saved_in, STDIN_FILENO);
+        close(s->saved_in);
+    }
+}
+
+#endif
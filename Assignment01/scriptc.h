@@ -0,0 +1,344 @@
+/*
+*  scriptc.h: compiled scripts, parsed once and mmapped on later runs
+*  Only used when asked for (myshellv2 -C), since it writes to the cache
+*  directory of memo.h ($CACHEDIR, ~/.pucit_cache by default). The first
+*  run of a script file records what parse_pipeline() made of each line
+*  while the line runs, and at the end of the script writes it out there
+*  as one compact image, named after a 128 bit hash of the script's
+*  contents. A later run of the same text maps that image and executes
+*  straight from it: stage argv arrays and "<" / ">" files point into the
+*  map, nothing is lexed or parsed.
+*  The image, all offsets 32 bit, the arrays in this order:
+*     script_header   magic, counts
+*     script_line     per non empty line: its stages, "&", or SCRIPT_RAW
+*     script_stage    per stage: its words, its "<" and ">" files
+*     uint32_t        word offsets into the text, SCRIPT_NONE ends a stage
+*     char            the NUL terminated words, each distinct word once
+*  A line that does not parse is kept as SCRIPT_RAW with its source text and
+*  goes through parse_pipeline() again, so its error appears where it did.
+*  Images are ordinary cache entries: counted in the cache size and evicted
+*  least recently used first along with memoized output (a run touches it).
+*  myshellv2 has no shell variables ($ words are passed on as they are), so
+*  there are no variable slots to record.
+*  Needs _GNU_SOURCE (pipe2, F_SETPIPE_SZ for pipeline.h) defined before the
+*  first include.
+*/
+#ifndef SCRIPTC_H
+#define SCRIPTC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pipeline.h"
+#include "memo.h"
+
+#define SCRIPT_NONE UINT32_MAX  // no file, or the end of a stage's words
+#define SCRIPT_BG   1           // line ends with "&"
+#define SCRIPT_RAW  2           // did not parse, raw is the source text
+
+struct script_header {
+    char magic[8];
+    uint32_t lines, stages, words;
+    uint32_t text_len;
+};
+
+struct script_line {
+    uint32_t first_stage, stages;
+    uint32_t flags;
+    uint32_t raw;       // SCRIPT_RAW: text offset of the line
+};
+
+struct script_stage {
+    uint32_t first_word, argc;
+    uint32_t input, output;     // text offsets, SCRIPT_NONE if none
+};
+
+static const char script_magic[8] = "PUCSCRC1";
+
+// Growable byte array, one per section while recording
+struct script_buf {
+    char *data;
+    size_t len, cap;
+};
+
+struct script {
+    char entry[4096];   // the image's path in the cache directory
+    int recording;      // first run: lines are added as they run
+    int failed;         // too big or odd, the image is not written
+    // Recording
+    struct script_buf lines, stages, words, text;
+    size_t raw_start;   // where the current line's source text went
+    uint32_t *interned; // open addressing set of word offsets, text + 1
+    size_t interned_count, interned_cap;
+    // Running from a mapped image
+    void *map;
+    size_t map_len;
+    const struct script_header *header;
+    const struct script_line *line;
+    const struct script_stage *stage;
+    const char *strings;
+    char **argv;        // every stage's argv, NULL terminated, into the map
+};
+
+static inline void *script_buf_add(struct script_buf *b, const void *data, size_t len) {
+    if (b->len + len > b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 4096;
+        while (b->cap < b->len + len) b->cap *= 2;
+        b->data = realloc(b->data, b->cap);
+    }
+    void *at = b->data + b->len;
+    memcpy(at, data, len);
+    b->len += len;
+    return at;
+}
+
+static inline uint32_t script_hash(const char *str) {
+    uint32_t h = 2166136261u;
+    while (*str) h = (h ^ (unsigned char)*str++) * 16777619u;
+    return h;
+}
+
+static inline void script_intern_grow(struct script *s) {
+    size_t old_cap = s->interned_cap;
+    uint32_t *old = s->interned;
+    s->interned_cap = old_cap ? old_cap * 2 : 1024;
+    s->interned = calloc(s->interned_cap, sizeof(*s->interned));
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i] == 0) continue;
+        size_t k = script_hash(s->text.data + old[i] - 1) & (s->interned_cap - 1);
+        while (s->interned[k]) k = (k + 1) & (s->interned_cap - 1);
+        s->interned[k] = old[i];
+    }
+    free(old);
+}
+
+// Appends str to the text unless it is there already, returns its offset
+static inline uint32_t script_add_string(struct script *s, const char *str) {
+    if (str == NULL) return SCRIPT_NONE;
+    if ((s->interned_count + 1) * 2 > s->interned_cap) script_intern_grow(s);
+    size_t k = script_hash(str) & (s->interned_cap - 1);
+    for (; s->interned[k]; k = (k + 1) & (s->interned_cap - 1))
+        if (strcmp(s->text.data + s->interned[k] - 1, str) == 0) return s->interned[k] - 1;
+    size_t off = s->text.len;
+    script_buf_add(&s->text, str, strlen(str) + 1);
+    if (s->text.len >= SCRIPT_NONE) {
+        s->failed = 1;
+        return 0;
+    }
+    s->interned[k] = off + 1;
+    s->interned_count++;
+    return (uint32_t)off;
+}
+
+// Checks the image at s->map and sets up the argv table. -1 if it is not one
+static inline int script_load(struct script *s) {
+    const struct script_header *h = s->map;
+    if (s->map_len < sizeof(*h) || memcmp(h->magic, script_magic, sizeof(h->magic)) != 0) return -1;
+    size_t need = sizeof(*h) + (size_t)h->lines * sizeof(struct script_line) +
+                  (size_t)h->stages * sizeof(struct script_stage) + (size_t)h->words * 4 + h->text_len;
+    if (need != s->map_len || h->text_len == 0) return -1;
+    s->header = h;
+    s->line = (const struct script_line *)(h + 1);
+    s->stage = (const struct script_stage *)(s->line + h->lines);
+    const uint32_t *words = (const uint32_t *)(s->stage + h->stages);
+    s->strings = (const char *)(words + h->words);
+    if (s->strings[h->text_len - 1] != '\0') return -1;
+    s->argv = malloc((h->words + 1) * sizeof(char *));
+    for (uint32_t i = 0; i < h->words; i++) {
+        if (words[i] != SCRIPT_NONE && words[i] >= h->text_len) return -1;
+        s->argv[i] = words[i] == SCRIPT_NONE ? NULL : (char *)s->strings + words[i];
+    }
+    // Every stage has words, none of them missing, and every line that
+    // parsed has stages: a damaged image is recorded again, never run
+    for (uint32_t i = 0; i < h->stages; i++) {
+        const struct script_stage *st = &s->stage[i];
+        if (st->argc == 0 || (uint64_t)st->first_word + st->argc >= h->words ||
+            s->argv[st->first_word + st->argc] != NULL ||
+            (st->input != SCRIPT_NONE && st->input >= h->text_len) ||
+            (st->output != SCRIPT_NONE && st->output >= h->text_len))
+            return -1;
+        for (uint32_t k = 0; k < st->argc; k++)
+            if (s->argv[st->first_word + k] == NULL) return -1;
+    }
+    for (uint32_t i = 0; i < h->lines; i++) {
+        const struct script_line *l = &s->line[i];
+        if ((uint64_t)l->first_stage + l->stages > h->stages ||
+            ((l->flags & SCRIPT_RAW) ? l->raw >= h->text_len : l->stages == 0))
+            return -1;
+    }
+    return 0;
+}
+
+static inline void script_close(struct script *s) {
+    if (s->map) munmap(s->map, s->map_len);
+    free(s->argv);
+    free(s->lines.data);
+    free(s->stages.data);
+    free(s->words.data);
+    free(s->text.data);
+    free(s->interned);
+    memset(s, 0, sizeof(*s));
+}
+
+// Looks up the compiled form of the script at path. Returns 1 when it is
+// mapped and ready to run, 0 when this run should record it and -1 when
+// there is no cache directory (or the script cannot be read): run as usual
+static inline int script_open(struct script *s, const char *path) {
+    memset(s, 0, sizeof(*s));
+    memo_init();
+    if (memo.dir == NULL) return -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (fd == -1 || fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_size >= SCRIPT_NONE / 2) {
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    struct memo_hash h = { 0 };
+    char hex[MEMO_KEY_LEN + 1];
+    memo_hash_update(&h, script_magic, sizeof(script_magic));  // never a memoized command's key
+    if (sb.st_size > 0) {
+        void *text = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        memo_hash_update(&h, text, sb.st_size);
+        munmap(text, sb.st_size);
+    }
+    close(fd);
+    memo_hash_hex(&h, hex);
+    snprintf(s->entry, sizeof(s->entry), "%s/%s", memo.dir, hex);
+
+    fd = open(s->entry, O_RDONLY | O_CLOEXEC);
+    if (fd != -1 && fstat(fd, &sb) == 0 && sb.st_size > 0) {
+        s->map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        s->map_len = sb.st_size;
+        if (s->map == MAP_FAILED) s->map = NULL;
+        if (s->map && script_load(s) == 0) {
+            futimens(fd, NULL);     // most recently used now, see memo_evict()
+            close(fd);
+            return 1;
+        }
+        // Damaged or from another version: record it again
+        char entry[sizeof(s->entry)];
+        memcpy(entry, s->entry, sizeof(entry));
+        script_close(s);
+        memcpy(s->entry, entry, sizeof(entry));
+    }
+    if (fd != -1) close(fd);
+    s->recording = 1;
+    return 0;
+}
+
+// Recording: keeps the source text of line in case it does not parse.
+// Call before parse_pipeline(), which takes the line apart
+static inline void script_begin_line(struct script *s, const char *line) {
+    s->raw_start = s->text.len;
+    script_buf_add(&s->text, line, strlen(line) + 1);   // not interned, it is usually dropped
+    if (s->text.len >= SCRIPT_NONE) s->failed = 1;
+}
+
+// Recording: adds what parse_pipeline() made of the line, pl is NULL if
+// it did not parse. Empty lines are left out
+static inline void script_end_line(struct script *s, const struct pipeline *pl) {
+    struct script_line l = { .first_stage = s->stages.len / sizeof(struct script_stage), .raw = s->raw_start };
+    if (pl == NULL) {
+        l.flags = SCRIPT_RAW;
+        script_buf_add(&s->lines, &l, sizeof(l));
+        return;
+    }
+    s->text.len = s->raw_start;     // parsed, the source is not needed
+    if (pl->count == 0) return;
+    l.stages = pl->count;
+    l.flags = pl->background ? SCRIPT_BG : 0;
+    for (int i = 0; i < pl->count; i++) {
+        const struct stage *st = &pl->stages[i];
+        struct script_stage out = {
+            .first_word = s->words.len / 4,
+            .argc = st->argc,
+            .input = script_add_string(s, st->input_file),
+            .output = script_add_string(s, st->output_file),
+        };
+        for (int k = 0; k <= st->argc; k++) {
+            uint32_t off = k < st->argc ? script_add_string(s, st->argv[k]) : SCRIPT_NONE;
+            script_buf_add(&s->words, &off, sizeof(off));
+        }
+        script_buf_add(&s->stages, &out, sizeof(out));
+    }
+    script_buf_add(&s->lines, &l, sizeof(l));
+    if (s->words.len / 4 >= SCRIPT_NONE / 2) s->failed = 1;
+}
+
+// Recording: writes the image once the whole script has run, renamed into
+// place so a concurrent run never maps half of it
+static inline void script_save(struct script *s) {
+    if (!s->recording || s->failed || s->text.len == 0) return;
+    struct script_header h = {
+        .lines = s->lines.len / sizeof(struct script_line),
+        .stages = s->stages.len / sizeof(struct script_stage),
+        .words = s->words.len / 4,
+        .text_len = s->text.len,
+    };
+    memcpy(h.magic, script_magic, sizeof(h.magic));
+    struct { const void *data; size_t len; } parts[] = {
+        { &h, sizeof(h) }, { s->lines.data, s->lines.len }, { s->stages.data, s->stages.len },
+        { s->words.data, s->words.len }, { s->text.data, s->text.len },
+    };
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s/tmp.XXXXXX", memo.dir);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd == -1) return;
+    size_t total = 0;
+    int ok = 1;
+    for (size_t i = 0; ok && i < sizeof(parts) / sizeof(parts[0]); i++) {
+        for (size_t w = 0; ok && w < parts[i].len;) {
+            ssize_t n = write(fd, (const char *)parts[i].data + w, parts[i].len - w);
+            if (n == -1 && errno == EINTR) continue;
+            ok = n > 0;
+            w += ok ? n : 0;
+        }
+        total += parts[i].len;
+    }
+    if (ok && rename(tmp, s->entry) == 0) {
+        memo.entries++;
+        memo.total += total;
+        if (memo.total > memo.max_bytes) memo_evict();
+    } else {
+        unlink(tmp);
+    }
+    close(fd);
+}
+
+// Running: sets pl up for line i of the mapped image, the stages' argv point
+// into the map. Returns NULL, or the source text of a SCRIPT_RAW line for
+// the caller to parse. pl must only be used through here, its stages do not
+// own their argv (release it with script_pipeline_free())
+static inline const char *script_pipeline(struct script *s, uint32_t i, struct pipeline *pl) {
+    const struct script_line *l = &s->line[i];
+    if (l->flags & SCRIPT_RAW) return s->strings + l->raw;
+    pl->count = 0;
+    pl->background = (l->flags & SCRIPT_BG) != 0;
+    for (uint32_t k = 0; k < l->stages; k++) {
+        const struct script_stage *in = &s->stage[l->first_stage + k];
+        struct stage *st = pipeline_add_stage(pl);
+        st->argv = s->argv + in->first_word;
+        st->argc = in->argc;
+        st->input_file = in->input == SCRIPT_NONE ? NULL : (char *)s->strings + in->input;
+        st->output_file = in->output == SCRIPT_NONE ? NULL : (char *)s->strings + in->output;
+    }
+    return NULL;
+}
+
+static inline void script_pipeline_free(struct pipeline *pl) {
+    free(pl->stages);
+    pl->stages = NULL;
+    pl->count = pl->cap = 0;
+}
+
+#endif
@@ -4,7 +4,7 @@
 *  Course: System Programming with Linux
 *  myshellv1.c: 
 *  main() displays a prompt, receives a string from keyboard, pass it to tokenize()
-*  tokenize() allocates dynamic memory and tokenize the string and return a char**
+*  tokenize() copies the string into a per-command arena and splits the copy in place (see lexer.h)
 *  main() then pass the tokenized string to execute() which calls fork and exec
 *  finally main() again displays the prompt and waits for next command string
 *   Limitations:
@@ -22,91 +22,76 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include "launcher.h"
+#include "input.h"
+#include "arena.h"
+#include "lexer.h"
 
-#define MAX_LEN 512
-#define MAXARGS 10
-#define ARGLEN 30
 #define PROMPT "PUCITshell:- "
 
 int execute(char* arglist[]);
-char** tokenize(char* cmdline);
-char* read_cmd(char*, FILE*);
-int main(){
+char** tokenize(char* cmdline, struct arena* arena);
+char* read_cmd(char*, struct line_reader*);
+int main(int argc, char* argv[]){
    char *cmdline;
    char** arglist;
    char* prompt = PROMPT;   
-   while((cmdline = read_cmd(prompt,stdin)) != NULL){
-      if((arglist = tokenize(cmdline)) != NULL){
+   struct line_reader reader; //buffered input, see input.h
+   struct arena arena; //memory of the current command, see arena.h
+   arena_init(&arena);
+   if(reader_from_args(&reader, argc, argv, 1) == -1)
+      exit(1);
+   while((cmdline = read_cmd(prompt, &reader)) != NULL){
+      if((arglist = tokenize(cmdline, &arena)) != NULL)
             execute(arglist);
-       //  need to free arglist
-         for(int j=0; j < MAXARGS+1; j++)
-	         free(arglist[j]);
-         free(arglist);
-         free(cmdline);
-      }
+      //the line copy and arglist live in the arena, one reset frees everything
+      arena_reset(&arena);
   }//end of while loop
-   printf("\n");
+   if(reader.interactive)
+      printf("\n");
+   arena_free(&arena);
+   reader_close(&reader);
    return 0;
 }
 int execute(char* arglist[]){
    int status;
-   int cpid = fork();
-   switch(cpid){
-      case -1:
-         perror("fork failed");
-	      exit(1);
-      case 0:
-	      execvp(arglist[0], arglist);
- 	      perror("Command not found...");
-	      exit(1);
-      default:
-	      waitpid(cpid, &status, 0);
-         printf("child exited with status %d \n", status >> 8);
-         return 0;
-   }
+   struct rusage ru;
+   //posix_spawn based launcher, see launcher.h
+   int cpid = launch_argv(arglist);
+   if(cpid == -1)
+      return -1;
+   uint64_t started = stats_now_ns();
+   wait4(cpid, &status, 0, &ru); //wait4 also hands back the child's resource usage, see stats.h
+   stats_child(&ru, stats_now_ns() - started);
+   printf("child exited with status %d \n", status >> 8);
+   return 0;
 }
-char** tokenize(char* cmdline){
-//allocate memory
-   char** arglist = (char**)malloc(sizeof(char*)* (MAXARGS+1));
-   for(int j=0; j < MAXARGS+1; j++){
-	   arglist[j] = (char*)malloc(sizeof(char)* ARGLEN);
-      bzero(arglist[j],ARGLEN);
-    }
-   if(cmdline[0] == '\0')//if user has entered nothing and pressed enter key
+//cmdline is copied into the arena and the tokens are slices of the copy,
+//unquoted and '\0' terminated in place by the shared lexer (see lexer.h);
+//the vector of pointers comes from the arena too, so there is no limit on
+//the number or the length of the arguments
+char** tokenize(char* cmdline, struct arena* arena){
+   static struct token_list tokens; //token spans, reused for every command
+   size_t len = strlen(cmdline);
+   char* line = arena_alloc(arena, len+1);
+   if(line == NULL){
+      perror("tokenize");
+      return NULL;
+   }
+   memcpy(line, cmdline, len+1);
+   if(lex_line(line, &tokens) <= 0)//nothing (or only spaces) entered, or a bad quote
+      return NULL;
+   char** arglist = arena_alloc(arena, sizeof(char*) * (tokens.count+1));
+   if(arglist == NULL){
+      perror("tokenize");
       return NULL;
-   int argnum = 0; //slots used
-   char*cp = cmdline; // pos in string
-   char*start;
-   int len;
-   while(*cp != '\0'){
-      while(*cp == ' ' || *cp == '\t') //skip leading spaces
-          cp++;
-      start = cp; //start of the word
-      len = 1;
-      //find the end of the word
-      while(*++cp != '\0' && !(*cp ==' ' || *cp == '\t'))
-         len++;
-      strncpy(arglist[argnum], start, len);
-      arglist[argnum][len] = '\0';
-      argnum++;
    }
-   arglist[argnum] = NULL;
+   lex_argv(&tokens, arglist, tokens.count+1);
    return arglist;
-}      
+}
 
-char* read_cmd(char* prompt, FILE* fp){
-   printf("%s", prompt);
-  int c; //input character
-   int pos = 0; //position of character in cmdline
-   char* cmdline = (char*) malloc(sizeof(char)*MAX_LEN);
-   while((c = getc(fp)) != EOF){
-       if(c == '\n')
-	  break;
-       cmdline[pos++] = c;
-   }
-//these two lines are added, in case user press ctrl+d to exit the shell
-   if(c == EOF && pos == 0) 
-      return NULL;
-   cmdline[pos] = '\0';
-   return cmdline;
-}
\ No newline at end of file
+//reads the next command, the prompt is only shown on a terminal
+//commands are read in big blocks and have no length limit (see input.h)
+char* read_cmd(char* prompt, struct line_reader* reader){
+   return read_line(reader, prompt);
+}
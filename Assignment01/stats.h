@@ -0,0 +1,143 @@
+/*
+*  stats.h: per-command resource accounting and latency histograms
+*  Every child is reaped with wait4(), which hands back its rusage. The
+*  shell adds it to the session totals (user/sys CPU, peak RSS, context
+*  switches) and records two latencies per command:
+*     spawn  time spent in posix_spawn(), i.e. clone + execve (what used to be
+*            fork + exec; with CLONE_VFORK the two cannot be timed apart)
+*     wait   time from the spawn returning until the child was reaped
+*  Latencies go into log-linear histograms (8 sub-buckets per power of two,
+*  within 12.5%) so p50/p95/p99 cost O(buckets) no matter how many commands
+*  ran. stats_print() is the "stats" builtin.
+*/
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+enum stat_phase { STAT_SPAWN, STAT_WAIT, STAT_PHASES };
+
+static const char *stat_phase_names[STAT_PHASES] = { "spawn", "wait" };
+
+struct latency_hist {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t n, sum_ns, max_ns;
+};
+
+struct session_usage {
+    uint64_t children;          // children reaped with their rusage
+    double utime, stime;        // CPU seconds summed over all children
+    long maxrss;                // largest peak RSS of any child, KiB
+    long nvcsw, nivcsw;         // voluntary / involuntary context switches
+    uint64_t timeouts;          // commands sent SIGTERM at their deadline (timeouts.h)
+    uint64_t timeout_kills;     // ... and SIGKILL after the grace period
+};
+
+static struct latency_hist stat_hist[STAT_PHASES];
+static struct session_usage stat_usage;
+
+static inline uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static inline unsigned hist_bucket(uint64_t v) {
+    if (v < (1u << HIST_SUB_BITS)) return v;
+    unsigned msb = 63 - __builtin_clzll(v);
+    unsigned sub = (v >> (msb - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1);
+    return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+}
+
+// Smallest value that falls into bucket b
+static inline uint64_t hist_bucket_low(unsigned b) {
+    if (b < (1u << HIST_SUB_BITS)) return b;
+    unsigned msb = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    uint64_t sub = b & ((1u << HIST_SUB_BITS) - 1);
+    return ((1ull << HIST_SUB_BITS) + sub) << (msb - HIST_SUB_BITS);
+}
+
+static inline void stats_record(enum stat_phase phase, uint64_t ns) {
+    struct latency_hist *h = &stat_hist[phase];
+    h->counts[hist_bucket(ns)]++;
+    h->n++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns) h->max_ns = ns;
+}
+
+// Value below which a fraction p of the samples fall (bucket midpoint)
+static inline uint64_t hist_percentile(const struct latency_hist *h, double p) {
+    uint64_t rank = (uint64_t)(p * h->n + 0.5), seen = 0;
+    if (rank == 0) rank = 1;
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank) {
+            uint64_t low = hist_bucket_low(b);
+            uint64_t mid = low + (hist_bucket_low(b + 1) - low) / 2;
+            return mid < h->max_ns ? mid : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+static inline double tv_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Adds the rusage of a reaped child whose start time is not known (the
+// background children of myshellv3/v4, which keep no job table)
+static inline void stats_usage(const struct rusage *ru) {
+    stat_usage.children++;
+    stat_usage.utime += tv_seconds(ru->ru_utime);
+    stat_usage.stime += tv_seconds(ru->ru_stime);
+    if (ru->ru_maxrss > stat_usage.maxrss) stat_usage.maxrss = ru->ru_maxrss;
+    stat_usage.nvcsw += ru->ru_nvcsw;
+    stat_usage.nivcsw += ru->ru_nivcsw;
+}
+
+// Adds a reaped child: its rusage and how long it ran after being spawned
+static inline void stats_child(const struct rusage *ru, uint64_t wait_ns) {
+    stats_record(STAT_WAIT, wait_ns);
+    stats_usage(ru);
+}
+
+// One line in the style of time(1) for a single command
+// A negative ru_maxrss prints as "-", for a command that ran in the shell
+// itself: its peak is the shell's and says nothing about the command
+static inline void stats_print_usage(double real, const struct rusage *ru) {
+    char rss[32] = "-";
+    if (ru->ru_maxrss >= 0) snprintf(rss, sizeof(rss), "%ldKiB", ru->ru_maxrss);
+    fprintf(stderr, "real %.3fs  user %.3fs  sys %.3fs  maxrss %s  ctxsw %ld+%ld\n",
+            real, tv_seconds(ru->ru_utime), tv_seconds(ru->ru_stime), rss,
+            ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+static inline void stats_print(void) {
+    printf("%-6s %8s %10s %10s %10s %10s %10s\n", "phase", "count", "mean", "p50", "p95", "p99", "max");
+    for (int p = 0; p < STAT_PHASES; p++) {
+        const struct latency_hist *h = &stat_hist[p];
+        if (h->n == 0) {
+            printf("%-6s %8d\n", stat_phase_names[p], 0);
+            continue;
+        }
+        printf("%-6s %8llu %8.1fus %8.1fus %8.1fus %8.1fus %8.1fus\n", stat_phase_names[p],
+               (unsigned long long)h->n, h->sum_ns / 1e3 / h->n, hist_percentile(h, 0.50) / 1e3,
+               hist_percentile(h, 0.95) / 1e3, hist_percentile(h, 0.99) / 1e3, h->max_ns / 1e3);
+    }
+    printf("children %llu  user %.3fs  sys %.3fs  max rss %ldKiB  ctxsw %ld voluntary %ld involuntary\n",
+           (unsigned long long)stat_usage.children, stat_usage.utime, stat_usage.stime,
+           stat_usage.maxrss, stat_usage.nvcsw, stat_usage.nivcsw);
+    if (stat_usage.timeouts)
+        printf("timed out %llu  killed after the grace period %llu\n",
+               (unsigned long long)stat_usage.timeouts, (unsigned long long)stat_usage.timeout_kills);
+}
+
+#endif
@@ -0,0 +1,36 @@
+#!/bin/sh
+#  jobs_test.sh: job numbers and "kill N" for background pipelines
+#  The inner stages of a background pipeline take no job number, so the
+#  job after a pipeline is [2], and "kill N" reaches the whole pipeline and
+#  nothing else.
+#  usage: tests/jobs_test.sh [shell]   (default ./myshellv5, run from Assignment01)
+shell=${1:-./myshellv5}
+fails=0
+
+check() {   # check <what> <expected line> <output>
+    if printf '%s\n' "$3" | grep -qxF -- "$2"; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1: no line \"$2\" in"
+        printf '%s\n' "$3" | sed 's/^/     /'
+        fails=$((fails + 1))
+    fi
+}
+
+for flags in "" "-z"; do
+    mode=${flags:+$flags: }
+    out=$(printf '%s\n' 'sleep 0.3 | cat &' 'sleep 0.3 &' 'kill 3' 'kill 2' '/bin/sleep 0.6' |
+          $shell $flags 2>&1 | sed 's/ [0-9]*$//')
+    check "${mode}the job after a pipeline is 2" "[2]" "$out"
+    check "${mode}no job 3" "Invalid job number." "$out"
+    check "${mode}kill 2 kills the plain job" "[2] Killed (signal 9) sleep 0.3" "$out"
+    check "${mode}the pipeline is left alone" "[1] Finished sleep 0.3 | cat" "$out"
+
+    out=$(printf '%s\n' 'sleep 31.7 | cat &' 'kill 1' '/bin/sleep 0.3' \
+                 "/bin/sh -c 'pgrep -f \"^sleep 31.7\" || echo gone'" | $shell $flags 2>&1)
+    check "${mode}kill 1 kills every stage" "gone" "$out"
+    pkill -f "^sleep 31.7"
+done
+
+[ $fails -eq 0 ] && echo "all passed" || echo "$fails failed"
+[ $fails -eq 0 ]
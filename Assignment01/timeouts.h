@@ -0,0 +1,178 @@
+/*
+*  timeouts.h: wall clock deadlines for commands, one timerfd for all of them
+*  "timeout [-k grace] secs command..." gives every process of the line a
+*  deadline. Deadlines sit in one binary min-heap ordered by when they next
+*  act, and a single timerfd (watched by the event loop, see evloop.h) is
+*  always set to the top of the heap, so arming or cancelling one costs
+*  O(log n) and nothing wakes the shell before the earliest deadline.
+*  At the deadline the process gets SIGTERM and goes back into the heap for
+*  the grace period (TIMEOUT_GRACE seconds unless -k says otherwise), then
+*  gets SIGKILL if it is still there. A deadline is cancelled as soon as its
+*  process is reaped. Timeouts and kills are counted in the session stats.
+*/
+#ifndef TIMEOUTS_H
+#define TIMEOUTS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "stats.h"
+
+#define TIMEOUT_GRACE 5.0
+
+struct timeout {
+    double when;        // CLOCK_MONOTONIC seconds of the next step
+    double grace;       // seconds from SIGTERM to SIGKILL
+    pid_t pid;
+    int index;          // position in the heap, -1 when not armed
+    int signalled;      // SIGTERM sent, SIGKILL is next
+    int fired;          // the deadline passed while the process ran
+};
+
+static struct {
+    struct timeout **heap;
+    size_t count, cap;
+    int fd;             // the timerfd, -1 until timeouts_init()
+} timeouts = { .fd = -1 };
+
+static inline double timeout_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Creates the timerfd, returns it for the event loop to watch
+static inline int timeouts_init(void) {
+    if (timeouts.fd == -1)
+        timeouts.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return timeouts.fd;
+}
+
+// Points the timerfd at the top of the heap, or disarms it
+static inline void timeouts_rearm(void) {
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+    if (timeouts.count) {
+        double when = timeouts.heap[0]->when;
+        its.it_value.tv_sec = (time_t)when;
+        its.it_value.tv_nsec = (long)((when - (time_t)when) * 1e9);
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) its.it_value.tv_nsec = 1;
+    }
+    if (timeouts.fd != -1) timerfd_settime(timeouts.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static inline void timeout_place(size_t i, struct timeout *t) {
+    timeouts.heap[i] = t;
+    t->index = i;
+}
+
+static inline void timeout_sift_up(size_t i) {
+    struct timeout *t = timeouts.heap[i];
+    while (i > 0 && timeouts.heap[(i - 1) / 2]->when > t->when) {
+        timeout_place(i, timeouts.heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    timeout_place(i, t);
+}
+
+static inline void timeout_sift_down(size_t i) {
+    struct timeout *t = timeouts.heap[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= timeouts.count) break;
+        if (child + 1 < timeouts.count && timeouts.heap[child + 1]->when < timeouts.heap[child]->when)
+            child++;
+        if (timeouts.heap[child]->when >= t->when) break;
+        timeout_place(i, timeouts.heap[child]);
+        i = child;
+    }
+    timeout_place(i, t);
+}
+
+static inline void timeout_push(struct timeout *t) {
+    if (timeouts.count == timeouts.cap) {
+        timeouts.cap = timeouts.cap ? timeouts.cap * 2 : 16;
+        timeouts.heap = realloc(timeouts.heap, timeouts.cap * sizeof(*timeouts.heap));
+    }
+    timeouts.heap[timeouts.count++] = t;
+    timeout_sift_up(timeouts.count - 1);
+}
+
+// Takes t out of the heap wherever it is
+static inline void timeout_remove(struct timeout *t) {
+    size_t i = t->index;
+    struct timeout *last = timeouts.heap[--timeouts.count];
+    t->index = -1;
+    if (i == timeouts.count) return;
+    timeout_place(i, last);
+    timeout_sift_up(i);
+    timeout_sift_down(last->index);
+}
+
+// Gives pid secs seconds from now, then grace more after SIGTERM
+static inline void timeout_arm(struct timeout *t, pid_t pid, double secs, double grace) {
+    t->pid = pid;
+    t->when = timeout_clock() + secs;
+    t->grace = grace;
+    t->signalled = t->fired = 0;
+    timeout_push(t);
+    if (t->index == 0) timeouts_rearm();
+}
+
+// Cancels the deadline of a process that has ended, if it had one
+static inline void timeout_disarm(struct timeout *t) {
+    if (t->index < 0) return;
+    int top = t->index == 0;
+    timeout_remove(t);
+    if (top) timeouts_rearm();
+}
+
+// Handles a timerfd wakeup: signals every process whose time has come
+static inline void timeouts_fire(void) {
+    uint64_t expirations;
+    if (read(timeouts.fd, &expirations, sizeof(expirations)) == -1) {
+        // EAGAIN: rearmed since it went off, check the heap anyway
+    }
+    double now = timeout_clock();
+    while (timeouts.count && timeouts.heap[0]->when <= now) {
+        struct timeout *t = timeouts.heap[0];
+        timeout_remove(t);
+        if (!t->signalled) {
+            kill(t->pid, SIGTERM);
+            t->signalled = t->fired = 1;
+            stat_usage.timeouts++;
+            t->when = now + t->grace;
+            timeout_push(t);
+        } else {
+            kill(t->pid, SIGKILL);
+            stat_usage.timeout_kills++;
+        }
+    }
+    timeouts_rearm();
+}
+
+// Reads "[-k grace] secs" in front of the command. Returns the number of
+// words they took, or -1 with the error printed
+static inline int timeout_parse(char **args, double *secs, double *grace) {
+    int a = 0;
+    char *end;
+    *grace = TIMEOUT_GRACE;
+    if (args[a] && strcmp(args[a], "-k") == 0) {
+        if (args[a + 1] == NULL || (*grace = strtod(args[a + 1], &end)) < 0 || *end) {
+            fprintf(stderr, "timeout: -k needs a number of seconds\n");
+            return -1;
+        }
+        a += 2;
+    }
+    if (args[a] == NULL || args[a + 1] == NULL || (*secs = strtod(args[a], &end)) <= 0 || *end) {
+        fprintf(stderr, "usage: timeout [-k grace] seconds command...\n");
+        return -1;
+    }
+    return a + 1;
+}
+
+#endif
@@ -0,0 +1,214 @@
+/*
+*  vars.h: shell variable store
+*  Variables live in a dense array kept in insertion order (so printenc and
+*  list_vars print them the way they were defined) and are found through an
+*  open addressing hash index over that array, which makes set, get and
+*  export O(1) with no limit on the number of variables.
+*  Names are interned in a chunked string pool: each name is stored once,
+*  together with its hash, and never moves or gets freed while the store lives.
+*  var_envp() hands out the environment for child processes: the inherited
+*  environ with every global variable added or overriding it. The array is
+*  cached and only rebuilt after a global variable was set, exported or
+*  changed, so starting a command costs nothing however many are exported.
+*/
+#ifndef VARS_H
+#define VARS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define VAR_POOL_CHUNK (64 * 1024)   // bytes per name pool chunk
+
+struct var {
+    char *name;     // interned, owned by the pool
+    char *value;
+    int global;     // Boolean indicating if it's a global variable (1 for global, 0 for local)
+    uint32_t hash;  // hash of name, compared before the strings
+};
+
+struct var_pool_chunk {
+    struct var_pool_chunk *next;
+    size_t used, size;
+    char data[];
+};
+
+struct var_table {
+    struct var *vars;       // insertion ordered entries
+    size_t count, cap;
+    uint32_t *index;        // entry number + 1 per slot, 0 marks an empty slot
+    size_t slots;           // power of two
+    struct var_pool_chunk *pool;
+    char **envp;            // cached child environment, see var_envp()
+    char *env_strings;      // the "name=value" strings of the globals in envp
+    int env_dirty;          // a global changed since envp was built
+};
+
+static inline uint32_t var_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Copies a name into the pool, the copy stays valid until var_table_free()
+static inline char *var_intern(struct var_table *t, const char *name) {
+    size_t len = strlen(name) + 1;
+    struct var_pool_chunk *c = t->pool;
+    if (c == NULL || c->size - c->used < len) {
+        size_t size = len > VAR_POOL_CHUNK ? len : VAR_POOL_CHUNK;
+        c = malloc(sizeof(*c) + size);
+        c->next = t->pool;
+        c->used = 0;
+        c->size = size;
+        t->pool = c;
+    }
+    char *copy = c->data + c->used;
+    memcpy(copy, name, len);
+    c->used += len;
+    return copy;
+}
+
+// Returns the slot that holds name or the empty slot where it would go
+static inline uint32_t *var_slot(const struct var_table *t, const char *name, uint32_t hash) {
+    size_t mask = t->slots - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t e = t->index[i];
+        if (e == 0)
+            return &t->index[i];
+        const struct var *v = &t->vars[e - 1];
+        if (v->hash == hash && strcmp(v->name, name) == 0)
+            return &t->index[i];
+    }
+}
+
+static inline void var_rehash(struct var_table *t, size_t slots) {
+    free(t->index);
+    t->slots = slots;
+    t->index = calloc(slots, sizeof(uint32_t));
+    size_t mask = slots - 1;
+    for (size_t n = 0; n < t->count; n++) {
+        size_t i = t->vars[n].hash & mask;
+        while (t->index[i])
+            i = (i + 1) & mask;
+        t->index[i] = n + 1;
+    }
+}
+
+static inline struct var *var_find(const struct var_table *t, const char *name) {
+    if (t->count == 0) return NULL;
+    uint32_t e = *var_slot(t, name, var_hash(name));
+    return e ? &t->vars[e - 1] : NULL;
+}
+
+// Adds name or updates its value, returns the entry. Once global (exported)
+// a variable stays global, as it does in sh
+static inline struct var *var_set(struct var_table *t, const char *name, const char *value, int global) {
+    uint32_t hash = var_hash(name);
+    if (t->slots == 0 || (t->count + 1) * 4 > t->slots * 3)
+        var_rehash(t, t->slots ? t->slots * 2 : 64);  // keep the index at most 75% full
+    uint32_t *slot = var_slot(t, name, hash);
+    if (*slot) {
+        struct var *v = &t->vars[*slot - 1];
+        if (v->global || global)
+            t->env_dirty = 1;
+        free(v->value);
+        v->value = strdup(value);
+        v->global |= global;
+        return v;
+    }
+    if (t->count == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 64;
+        t->vars = realloc(t->vars, t->cap * sizeof(*t->vars));
+    }
+    struct var *v = &t->vars[t->count++];
+    v->name = var_intern(t, name);
+    v->value = strdup(value);
+    v->global = global;
+    v->hash = hash;
+    *slot = t->count;
+    if (global)
+        t->env_dirty = 1;
+    return v;
+}
+
+// Makes an existing variable global
+static inline void var_export(struct var_table *t, struct var *v) {
+    if (!v->global) {
+        v->global = 1;
+        t->env_dirty = 1;
+    }
+}
+
+extern char **environ;
+
+// The environment for execve()/posix_spawn(), valid until the next call
+// after a global changed. environ itself when nothing is exported
+static inline char **var_envp(struct var_table *t) {
+    if (t->envp && !t->env_dirty)
+        return t->envp;
+    if (t->envp != environ)
+        free(t->envp);
+    free(t->env_strings);
+    t->envp = NULL;
+    t->env_strings = NULL;
+    t->env_dirty = 0;
+
+    size_t globals = 0, bytes = 0, inherited = 0;
+    for (size_t i = 0; i < t->count; i++) {
+        if (t->vars[i].global) {
+            globals++;
+            bytes += strlen(t->vars[i].name) + strlen(t->vars[i].value) + 2;
+        }
+    }
+    if (globals == 0) {
+        t->envp = environ;
+        return environ;
+    }
+    while (environ[inherited]) inherited++;
+
+    char **envp = malloc((inherited + globals + 1) * sizeof(char *));
+    size_t n = 0;
+    // Inherited entries stay unless a global of the same name replaces them
+    for (size_t i = 0; i < inherited; i++) {
+        char name[256];
+        size_t len = strcspn(environ[i], "=");
+        if (len < sizeof(name)) {
+            memcpy(name, environ[i], len);
+            name[len] = '\0';
+            struct var *v = var_find(t, name);
+            if (v && v->global) continue;
+        }
+        envp[n++] = environ[i];
+    }
+    char *s = t->env_strings = malloc(bytes);
+    for (size_t i = 0; i < t->count; i++) {
+        const struct var *v = &t->vars[i];
+        if (!v->global) continue;
+        envp[n++] = s;
+        s = stpcpy(stpcpy(stpcpy(s, v->name), "="), v->value) + 1;
+    }
+    envp[n] = NULL;
+    t->envp = envp;
+    return envp;
+}
+
+static inline void var_table_free(struct var_table *t) {
+    for (size_t i = 0; i < t->count; i++)
+        free(t->vars[i].value);
+    free(t->vars);
+    free(t->index);
+    if (t->envp != environ)
+        free(t->envp);
+    free(t->env_strings);
+    while (t->pool) {
+        struct var_pool_chunk *next = t->pool->next;
+        free(t->pool);
+        t->pool = next;
+    }
+    memset(t, 0, sizeof(*t));
+}
+
+#endif
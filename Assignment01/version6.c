@@ -1,175 +1,208 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include "launcher.h"
+#include "input.h"
+#include "vars.h"
+#include "builtins.h"
+#include "lexer.h"
+#include "expand.h"
 
-#define MAX_VARS 100   // Maximum number of variables
+#define MAX_ARGS 64    // Maximum number of arguments of the hash builtin
 
-struct var {
-    char *name;
-    char *value;
-    int global; // Boolean indicating if it's a global variable (1 for global, 0 for local)
-};
+// Hash table of variables, no fixed limit (see vars.h)
+struct var_table vars;
 
-// Array to store variables
-struct var vars[MAX_VARS];
-int var_count = 0;
+// Compiled expansion templates of the lines run so far (see expand.h)
+struct expand_cache expansions;
 
 // Function to add or update a variable
 void set_var(const char *name, const char *value, int global) {
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(vars[i].name, name) == 0) {
-            free(vars[i].value);
-            vars[i].value = strdup(value);
-            vars[i].global = global;
-            return;
-        }
-    }
-    // Add a new variable if it doesn't exist
-    if (var_count < MAX_VARS) {
-        vars[var_count].name = strdup(name);
-        vars[var_count].value = strdup(value);
-        vars[var_count].global = global;
-        var_count++;
-    } else {
-        printf("Error: Variable limit reached\n");
+    // Changing PATH makes every cached command location stale
+    if (strcmp(name, "PATH") == 0) {
+        path_hash_set_path(value);
     }
+    var_set(&vars, name, value, global);
 }
 
 // Function to get the value of a variable
 char *get_var(const char *name) {
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(vars[i].name, name) == 0) {
-            return vars[i].value;
-        }
-    }
-    return NULL;
+    struct var *v = var_find(&vars, name);
+    return v ? v->value : NULL;
 }
 
 // Function to handle the "printenc" command
 void printenc() {
-    for (int i = 0; i < var_count; i++) {
-        printf("%s=%s\n", vars[i].name, vars[i].value);
+    for (size_t i = 0; i < vars.count; i++) {
+        printf("%s=%s\n", vars.vars[i].name, vars.vars[i].value);
     }
 }
 
-// Function to handle the "eco" command with variable substitution
+// Function to handle the "eco" command, the text arrives with its variables
+// already substituted by the expansion stage (see expand.h), so any length works
 void eco(const char *input) {
-    char buffer[256];
-    int j = 0;
-
-    for (int i = 0; input[i] != '\0'; i++) {
-        if (input[i] == '$' && (i == 0 || input[i-1] == ' ')) {
-            // Detect variable substitution
-            char var_name[64];
-            int k = 0;
-            i++; // Skip '$'
-            while (input[i] != '\0' && input[i] != ' ' && k < 63) {
-                var_name[k++] = input[i++];
-            }
-            var_name[k] = '\0';
-
-            // Get variable value
-            char *value = get_var(var_name);
-            if (value) {
-                int m = 0;
-                while (value[m] != '\0' && j < 255) {
-                    buffer[j++] = value[m++];
-                }
-            } else {
-                // Variable not found, keep the original name
-                buffer[j++] = '$';
-                for (int n = 0; n < k && j < 255; n++) {
-                    buffer[j++] = var_name[n];
-                }
-            }
-            if (input[i] != '\0') i--; // Re-adjust for outer loop increment
-        } else {
-            // Regular character, copy to buffer
-            buffer[j++] = input[i];
-        }
-    }
-    buffer[j] = '\0';
-    printf("%s\n", buffer);
+    printf("%s\n", input);
 }
 // Function to display user-defined and environment variables separately
 void list_vars() {
     printf("User-defined variables:\n");
-    for (int i = 0; i < var_count; i++) {
-        if (!vars[i].global) {
-            printf("  %s=%s\n", vars[i].name, vars[i].value);
+    for (size_t i = 0; i < vars.count; i++) {
+        if (!vars.vars[i].global) {
+            printf("  %s=%s\n", vars.vars[i].name, vars.vars[i].value);
         }
     }
     printf("\nEnvironment variables:\n");
-    for (int i = 0; i < var_count; i++) {
-        if (vars[i].global) {
-            printf("  %s=%s\n", vars[i].name, vars[i].value);
+    for (size_t i = 0; i < vars.count; i++) {
+        if (vars.vars[i].global) {
+            printf("  %s=%s\n", vars.vars[i].name, vars.vars[i].value);
         }
     }
 }
 
 // Function to export a user-defined variable as an environment variable
 void export_var(const char *name) {
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(vars[i].name, name) == 0) {
-            vars[i].global = 1;
-            return;
-        }
+    struct var *v = var_find(&vars, name);
+    if (v) {
+        var_export(&vars, v);  // Child environments are rebuilt on the next command
+        return;
     }
     // If variable doesn't exist, create it as an environment variable with an empty value
     set_var(name, "", 1);
 }
 
-// Function to process a command
-void process_command(char *command) {
-    if (strncmp(command, "printenc", 8) == 0) {
-        printenc();
-    } else if (strncmp(command, "eco ", 4) == 0) {
-        eco(command + 4);  // Skip "eco " to get the argument part
-    } else if (strncmp(command, "set ", 4) == 0) {
-        // Parse set command to get variable name and value
-        char *name = strtok(command + 4, "=");
-        char *value = strtok(NULL, "\0");
-        if (name && value) {
-            set_var(name, value, 0); // Assuming local by default
-        } else {
-            printf("Error: Invalid set syntax. Use 'set name=value'.\n");
-        }
-    } else if (strncmp(command, "export ", 7) == 0) {
-        // Export a variable as environment
-        char *name = command + 7;
-        // Trim whitespace
-        while (*name == ' ') name++;
-        export_var(name);
-    } else if (strncmp(command, "list", 4) == 0) {
-        list_vars();
+// Function to run anything that is not a shell command as an external program.
+// The line is lexed and compiled once (see expand.h), running it again only
+// substitutes the current variable values
+void run_external(char *command) {
+    static char **args;
+    static int args_cap;
+    struct template *t = expand_cache_get(&expansions, command, TPL_WORDS);
+    if (t == NULL || t->argc == 0) return;
+    if (t->argc + 1 > args_cap) {
+        args_cap = t->argc + 1;
+        args = realloc(args, args_cap * sizeof(char *));
+    }
+    template_expand(&expansions, t, &vars, args, args_cap);
+
+    // Children get the inherited environment plus every exported variable,
+    // from the cached envp (see vars.h), and are resolved through the PATH hash table
+    struct launch_spec spec;
+    launch_spec_init(&spec, args);
+    spec.envp = var_envp(&vars);
+    pid_t pid = launch_command(&spec);
+    if (pid > 0) {
+        struct rusage ru;
+        uint64_t started = stats_now_ns();
+        wait4(pid, NULL, 0, &ru);  // usage goes into the session totals, see stats.h
+        stats_child(&ru, stats_now_ns() - started);
+    }
+}
+
+// Set by the exit builtin, ends the main loop
+int exit_requested = 0;
+
+// Builtin handlers, looked up by exact name in the builtin registry (see builtins.h).
+// rest is the text after the command name with leading spaces skipped
+void builtin_printenc(char **args, char *rest) {
+    printenc();
+}
+
+void builtin_eco(char **args, char *rest) {
+    eco(rest);
+}
+
+void builtin_set(char **args, char *rest) {
+    // Parse set command to get variable name and value
+    char *name = strtok(rest, "=");
+    char *value = strtok(NULL, "\0");
+    if (name && value) {
+        set_var(name, value, 0); // Assuming local by default
     } else {
-        printf("Error: Unknown command '%s'.\n", command);
+        printf("Error: Invalid set syntax. Use 'set name=value'.\n");
     }
 }
 
-// Main function
-int main() {
-    char command[256];
+void builtin_export(char **args, char *rest) {
+    // Export a variable as environment
+    if (*rest == '\0') {
+        printf("Error: Invalid export syntax. Use 'export name'.\n");
+        return;
+    }
+    export_var(rest);
+}
 
-    printf("Welcome to the shell! Type 'exit' to quit.\n");
-    while (1) {
-        printf("> ");
-        if (fgets(command, sizeof(command), stdin) == NULL) break;
+void builtin_list(char **args, char *rest) {
+    list_vars();
+}
 
-        // Remove trailing newline character
-        command[strcspn(command, "\n")] = '\0';
+void builtin_hash(char **args, char *rest) {
+    // Show or reset the PATH lookup cache
+    static struct token_list tokens;
+    char *hash_args[MAX_ARGS];
+    hash_args[0] = args[0];
+    if (lex_line(rest, &tokens) == -1) return;
+    lex_argv(&tokens, hash_args + 1, MAX_ARGS - 1);
+    hash_builtin(hash_args);
+}
+
+void builtin_exit(char **args, char *rest) {
+    exit_requested = 1;
+}
 
-        if (strcmp(command, "exit") == 0) break;
+// Fills the builtin registry, once at startup
+void register_builtins() {
+    builtin_register("printenc", builtin_printenc, "printenc");
+    builtin_register("eco", builtin_eco, "eco <text with $variables>");
+    builtin_register("set", builtin_set, "set name=value");
+    builtin_register("export", builtin_export, "export name");
+    builtin_register("list", builtin_list, "list");
+    builtin_register("hash", builtin_hash, "hash [-r] [name...]");
+    builtin_register("exit", builtin_exit, "exit");
+}
+
+// Function to process a command: one registry lookup on the first word,
+// anything that is not a builtin runs as an external program. Variables are
+// substituted for both, builtins get the expanded text of their arguments
+void process_command(char *command) {
+    while (*command == ' ') command++;
+    size_t len = strcspn(command, " ");
+    char saved = command[len];
+    command[len] = '\0';
+    const struct builtin *builtin = builtin_find(command);
+    if (builtin == NULL) {
+        command[len] = saved;
+        run_external(command);
+        return;
+    }
+    char *rest = command + len + (saved != '\0');
+    while (*rest == ' ') rest++;  // Trim whitespace
+    rest = expand_raw(&expansions, rest, &vars);  // $VAR and ${VAR}, see expand.h
+    char *args[2] = { command, NULL };
+    builtin->fn(args, rest);
+}
+
+// Main function
+int main(int argc, char *argv[]) {
+    char *command;
+    struct line_reader reader;
+
+    // Commands come from -c, a script file or stdin (see input.h)
+    if (reader_from_args(&reader, argc, argv, 1) == -1) return 1;
+    register_builtins();
+
+    // Greeting and prompt only make sense on a terminal
+    if (reader.interactive) printf("Welcome to the shell! Type 'exit' to quit.\n");
+    while (!exit_requested) {
+        if ((command = read_line(&reader, "> ")) == NULL) break;
         process_command(command);
     }
 
     // Free allocated memory for variable names and values
-    for (int i = 0; i < var_count; i++) {
-        free(vars[i].name);
-        free(vars[i].value);
-    }
+    var_table_free(&vars);
+    expand_cache_free(&expansions);
 
-    printf("Goodbye!\n");
+    if (reader.interactive) printf("Goodbye!\n");
+    reader_close(&reader);
     return 0;
 }
-
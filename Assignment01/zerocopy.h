@@ -0,0 +1,74 @@
+/*
+*  zerocopy.h: moving bytes between two descriptors inside the kernel
+*  copy_fd() copies everything from in (until end of file) to out, with the
+*  first call that the pair of descriptors takes:
+*     copy_file_range()   regular file to regular file (reflinks where the
+*                         filesystem has them)
+*     splice()            either side is a pipe
+*     sendfile()          a regular file to anything else (a socket, a tty)
+*     read()/write()      the rest, through one 128 KiB buffer
+*  Every call uses and advances the descriptors' own offsets, so when one
+*  is refused part way (EINVAL, EXDEV, ENOSYS, e.g. an O_APPEND output) the
+*  next one carries on where it stopped. copy_file_range() is not tried on
+*  an O_APPEND output at all, it fails with EBADF there.
+*  Needs _GNU_SOURCE (splice, copy_file_range) defined before the first
+*  include.
+*/
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#define ZC_CHUNK (1 << 30)  // bytes asked for per call, calls return early at a pipe's capacity
+#define ZC_BUFFER (128 * 1024)
+
+enum zc_method { ZC_RANGE, ZC_SPLICE, ZC_SENDFILE };
+
+// Copies with one of the calls above. Returns 0 at end of input, -1 on an
+// error (errno set) and 1 if the call does not work for these descriptors
+static inline int zc_loop(enum zc_method method, int in, int out) {
+    for (;;) {
+        ssize_t n;
+        if (method == ZC_RANGE) n = copy_file_range(in, NULL, out, NULL, ZC_CHUNK, 0);
+        else if (method == ZC_SPLICE) n = splice(in, NULL, out, NULL, ZC_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        else n = sendfile(out, in, NULL, ZC_CHUNK);
+        if (n > 0) continue;
+        if (n == 0) return 0;
+        if (errno == EINTR) continue;
+        if (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP) return 1;
+        return -1;
+    }
+}
+
+static inline int zc_read_write(int in, int out) {
+    static char buf[ZC_BUFFER];
+    for (;;) {
+        ssize_t r = read(in, buf, sizeof(buf));
+        if (r == -1 && errno == EINTR) continue;
+        if (r <= 0) return r;
+        for (ssize_t w = 0; w < r;) {
+            ssize_t m = write(out, buf + w, r - w);
+            if (m == -1 && errno == EINTR) continue;
+            if (m == -1) return -1;
+            w += m;
+        }
+    }
+}
+
+// Copies in to out until in ends. Returns 0, or -1 with errno set
+static inline int copy_fd(int in, int out) {
+    struct stat si, so;
+    if (fstat(in, &si) == -1 || fstat(out, &so) == -1) return -1;
+    int r = 1;
+    int append = (fcntl(out, F_GETFL) & O_APPEND) != 0;
+    if (S_ISREG(si.st_mode) && S_ISREG(so.st_mode) && !append) r = zc_loop(ZC_RANGE, in, out);
+    if (r == 1 && (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode))) r = zc_loop(ZC_SPLICE, in, out);
+    if (r == 1 && S_ISREG(si.st_mode)) r = zc_loop(ZC_SENDFILE, in, out);
+    return r == 1 ? zc_read_write(in, out) : r;
+}
+
+#endif
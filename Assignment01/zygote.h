@@ -0,0 +1,346 @@
+/*
+*  zygote.h: optional pre-forked helper that starts commands for the shell
+*  zygote_start() forks a helper while the shell is still small, before any
+*  history, job or variable table exists. From then on the shell sends every
+*  command to it over a SOCK_SEQPACKET socketpair: the resolved path, argv,
+*  envp, the working directory (only when it changed) and the descriptors
+*  the command gets as stdin/stdout/stderr, passed with SCM_RIGHTS. The
+*  zygote spawns the command, answers with its pid and later with its exit
+*  status and rusage, which the shell feeds into its job table (see
+*  evloop.h). Commands are children of the zygote, so the shell never reaps
+*  them itself and never needs a pidfd for them.
+*  The zygote blocks SIGINT and SIGQUIT (Ctrl-C only reaches the command)
+*  and exits when the shell closes its end. A request that does not fit in
+*  one message (ZYGOTE_MSG_MAX) or that has a pre_exec hook (placement.h) is
+*  started locally with launch_command().
+*/
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "launcher.h"
+
+#define ZYGOTE_MSG_MAX (1 << 20)    // largest request, argv + envp included
+
+enum { ZYG_STARTED = 1, ZYG_EXITED };
+
+// Request header, followed by path, cwd (empty: unchanged), argv and envp
+// strings, each NUL terminated
+struct zygote_request {
+    uint32_t argc, envc;
+};
+
+struct zygote_reply {
+    int32_t type;       // ZYG_STARTED or ZYG_EXITED
+    int32_t pid;
+    int32_t err;        // ZYG_STARTED: posix_spawn() error, 0 when started
+    int32_t cwd_err;    // ZYG_STARTED: chdir() error, nothing was spawned
+    int32_t status;     // ZYG_EXITED: wait status
+    struct rusage usage;
+};
+
+typedef void (*zygote_exit_fn)(pid_t pid, int status, const struct rusage *ru);
+
+struct zygote {
+    pid_t pid;          // -1 when not running
+    int fd;             // the shell's end of the socketpair
+    char *cwd;          // last working directory sent
+    zygote_exit_fn on_exit;
+    char *buf;          // request being built
+};
+
+static struct zygote zyg = { .pid = -1, .fd = -1 };
+
+// ---- zygote side ----
+
+static inline void zygote_send(int fd, const struct zygote_reply *r) {
+    while (send(fd, r, sizeof(*r), MSG_NOSIGNAL) == -1 && errno == EINTR);
+}
+
+static inline void zygote_spawn(int sock, char *msg, size_t len, int *fds, int nfds) {
+    struct zygote_reply reply = { .type = ZYG_STARTED, .pid = -1 };
+    struct zygote_request req;
+    memcpy(&req, msg, sizeof(req));
+    char *p = msg + sizeof(req), *end = msg + len;
+    char *path = p;
+    p += strlen(p) + 1;
+    char *cwd = p;
+    p += strlen(p) + 1;
+    char **argv = malloc((req.argc + req.envc + 2) * sizeof(char *));
+    char **envp = argv + req.argc + 1;
+    for (uint32_t i = 0; i < req.argc && p < end; i++, p += strlen(p) + 1) argv[i] = p;
+    argv[req.argc] = NULL;
+    for (uint32_t i = 0; i < req.envc && p < end; i++, p += strlen(p) + 1) envp[i] = p;
+    envp[req.envc] = NULL;
+
+    if (*cwd && chdir(cwd) == -1) reply.cwd_err = errno;
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    for (int i = 0; i < nfds && i < 3; i++) posix_spawn_file_actions_adddup2(&fa, fds[i], i);
+    posix_spawnattr_t attr;
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    if (reply.cwd_err == 0) {
+        pid_t pid;
+        reply.err = posix_spawn(&pid, path, &fa, &attr, argv, envp);
+        if (reply.err == 0) reply.pid = pid;
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    for (int i = 0; i < nfds; i++) close(fds[i]);
+    free(argv);
+    zygote_send(sock, &reply);
+}
+
+// The helper's whole life: requests in, spawn, exit statuses out
+static inline void zygote_main(int sock) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGQUIT);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    int sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    char *msg = malloc(ZYGOTE_MSG_MAX);
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct pollfd pfd[2] = { { sock, POLLIN, 0 }, { sigfd, POLLIN, 0 } };
+    for (;;) {
+        if (poll(pfd, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfd[1].revents) {
+            struct signalfd_siginfo si;
+            while (read(sigfd, &si, sizeof(si)) == sizeof(si));
+            struct zygote_reply r = { .type = ZYG_EXITED };
+            pid_t pid;
+            while ((pid = wait4(-1, &r.status, WNOHANG, &r.usage)) > 0) {
+                r.pid = pid;
+                zygote_send(sock, &r);
+            }
+        }
+        if (pfd[0].revents) {
+            struct iovec iov = { msg, ZYGOTE_MSG_MAX };
+            struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1,
+                                 .msg_control = control, .msg_controllen = sizeof(control) };
+            ssize_t n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) break;  // the shell is gone
+            int fds[3], nfds = 0;
+            struct cmsghdr *c = CMSG_FIRSTHDR(&mh);
+            if (c && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+                nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                if (nfds > 3) nfds = 3;
+                memcpy(fds, CMSG_DATA(c), nfds * sizeof(int));
+            }
+            if ((size_t)n > sizeof(struct zygote_request)) {
+                zygote_spawn(sock, msg, n, fds, nfds);
+            } else {
+                for (int i = 0; i < nfds; i++) close(fds[i]);
+            }
+        }
+    }
+    _exit(0);
+}
+
+// ---- shell side ----
+
+// Forks the zygote. on_exit receives the exit status of every command it
+// started. Returns 0, or -1 (commands then start locally)
+static inline int zygote_start(zygote_exit_fn on_exit) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("zygote socketpair");
+        return -1;
+    }
+    int size = ZYGOTE_MSG_MAX;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("zygote fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        zygote_main(sv[1]);
+    }
+    close(sv[1]);
+    zyg.pid = pid;
+    zyg.fd = sv[0];
+    zyg.on_exit = on_exit;
+    zyg.buf = malloc(ZYGOTE_MSG_MAX);
+    return 0;
+}
+
+static inline void zygote_stop(void) {
+    if (zyg.pid == -1) return;
+    close(zyg.fd);
+    waitpid(zyg.pid, NULL, 0);
+    free(zyg.buf);
+    free(zyg.cwd);
+    zyg.pid = zyg.fd = -1;
+    zyg.buf = zyg.cwd = NULL;
+}
+
+// Reads replies from the zygote, blocking for the first one when wait is set
+// (for the ZYG_STARTED reply when started is given, exit reports can come
+// first). Exit statuses go to on_exit; a ZYG_STARTED reply is stored in
+// *started and ends the loop. Returns the number of replies, -1 once the zygote
+// has gone away (launches fall back to launch_command() from then on)
+static inline int zygote_collect(int wait, struct zygote_reply *started) {
+    struct zygote_reply r;
+    int handled = 0;
+    for (;;) {
+        ssize_t n = recv(zyg.fd, &r, sizeof(r), wait && (started || handled == 0) ? 0 : MSG_DONTWAIT);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return handled;
+        if (n != sizeof(r)) {
+            fprintf(stderr, "zygote exited, starting commands directly\n");
+            zygote_stop();
+            return -1;
+        }
+        handled++;
+        if (r.type == ZYG_EXITED) {
+            if (zyg.on_exit) zyg.on_exit(r.pid, r.status, &r.usage);
+        } else if (started) {
+            *started = r;
+            return handled;
+        }
+    }
+}
+
+static inline char *zygote_put(char *p, const char *s) {
+    size_t len = strlen(s) + 1;
+    if (p == NULL || p + len > zyg.buf + ZYGOTE_MSG_MAX) return NULL;
+    memcpy(p, s, len);
+    return p + len;
+}
+
+// Same contract as launch_command(): returns the pid or -1 with the error
+// printed. Started through the zygote while it runs (*remote set to 1, the
+// status arrives through on_exit), locally otherwise (*remote 0, a child of
+// the shell)
+static inline pid_t zygote_launch(const struct launch_spec *spec, int *remote) {
+    *remote = 0;
+    if (zyg.pid == -1 || spec->pre_exec) return launch_command(spec);
+
+    char **envp = spec->envp ? spec->envp : environ;
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+    int cwd_changed = cwd[0] && (zyg.cwd == NULL || strcmp(cwd, zyg.cwd) != 0);
+
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    int opened_in = -1, opened_out = -1;
+    if (spec->in_fd != -1) fds[0] = spec->in_fd;
+    if (spec->out_fd != -1) fds[1] = spec->out_fd;
+    if (spec->input_file) {
+        opened_in = fds[0] = open(spec->input_file, O_RDONLY | O_CLOEXEC);
+        if (opened_in == -1) {
+            perror("Error opening input file");
+            return -1;
+        }
+    }
+    if (spec->output_file) {
+        opened_out = fds[1] = open(spec->output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (opened_out == -1) {
+            perror("Error opening output file");
+            if (opened_in != -1) close(opened_in);
+            return -1;
+        }
+    }
+
+    pid_t pid = -1;
+    int err = ENOENT, local = 0, reported = 0;
+    fflush(stdout);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        const char *path = path_hash_lookup(spec->argv[0]);
+        if (path == NULL) break;
+
+        struct zygote_request req = { 0, 0 };
+        char *p = zyg.buf + sizeof(req);
+        p = zygote_put(p, path);
+        p = zygote_put(p, cwd_changed ? cwd : "");
+        for (; spec->argv[req.argc]; req.argc++) p = zygote_put(p, spec->argv[req.argc]);
+        for (; envp[req.envc]; req.envc++) p = zygote_put(p, envp[req.envc]);
+        if (p == NULL) {
+            local = 1;  // too big for one message
+            break;
+        }
+        memcpy(zyg.buf, &req, sizeof(req));
+
+        char control[CMSG_SPACE(sizeof(fds))];
+        memset(control, 0, sizeof(control));
+        struct iovec iov = { zyg.buf, p - zyg.buf };
+        struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1,
+                             .msg_control = control, .msg_controllen = sizeof(control) };
+        struct cmsghdr *c = CMSG_FIRSTHDR(&mh);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+        uint64_t t0 = stats_now_ns();
+        struct zygote_reply reply = { .type = 0 };
+        if (sendmsg(zyg.fd, &mh, MSG_NOSIGNAL) == -1 || zygote_collect(1, &reply) == -1 ||
+            reply.type != ZYG_STARTED) {
+            local = 1;
+            break;
+        }
+        if (reply.cwd_err) {
+            // The zygote cannot follow the shell's directory: no PATH problem,
+            // and cwd is sent again with the next command
+            err = reply.cwd_err;
+            fprintf(stderr, "%s: cannot run in %s: %s\n", spec->argv[0], cwd, strerror(err));
+            reported = 1;
+            break;
+        }
+        if (cwd_changed) {
+            free(zyg.cwd);
+            zyg.cwd = strdup(cwd);
+            cwd_changed = 0;
+        }
+        err = reply.err;
+        if (err == 0) {
+            pid = reply.pid;
+            stats_record(STAT_SPAWN, stats_now_ns() - t0);
+        }
+        if (err != ENOENT || path == spec->argv[0]) break;
+        path_hash_forget(spec->argv[0]);  // cached binary is gone, resolve again
+    }
+    if (opened_in != -1) close(opened_in);
+    if (opened_out != -1) close(opened_out);
+    if (local) return launch_command(spec);
+
+    *remote = err == 0;
+    if (err != 0) {
+        errno = err;
+        if (!reported)
+            fprintf(stderr, "%s: %s\n", spec->argv[0], err == ENOENT ? "command not found" : strerror(err));
+        return -1;
+    }
+    return pid;
+}
+
+#endif